@@ -0,0 +1,214 @@
+using Weber
+using ArgParse
+
+# HOW TO USE: run this script before deploying a new version of Weber (or
+# Julia, or its packages) to a lab machine.
+#
+#     julia benchmark/benchmarks.jl [--sdl] [--samples=200]
+#
+# By default the benchmarks run without any window or sound (null_window=true),
+# so they can run just about anywhere. With --sdl, a real window is used, and
+# the display and input benchmarks are also run. The percentiles of each
+# benchmark are written to a csv file and compared against the limits listed in
+# benchmark/thresholds.csv. The script exits with an error if any limit is
+# exceeded.
+
+settings = ArgParseSettings(description="Benchmark the timing of Weber.")
+@add_arg_table settings begin
+  "--sdl"
+    help = "run the benchmarks using a real window"
+    action = :store_true
+  "--samples"
+    help = "the number of samples to collect for each benchmark"
+    arg_type = Int
+    default = 200
+  "--output"
+    help = "the csv file to write the results to"
+    default = "benchmark_results.csv"
+  "--thresholds"
+    help = "a csv file listing the maximum time allowed for each benchmark"
+    default = joinpath(@__DIR__,"thresholds.csv")
+end
+args = parse_args(settings)
+const n_samples = args["samples"]
+const use_sdl = args["sdl"]
+const window_name = use_sdl ? "sdl" : "null"
+
+# run the given trials in an experiment, and return the durations (in seconds)
+# pushed to `times` during the experiment.
+function run_benchmark(fn;keys...)
+  times = Float64[]
+  exp = Experiment(;null_window=!use_sdl,hide_output=true,keys...)
+  setup(() -> fn(times),exp)
+  run(exp,await_input=false)
+  times
+end
+
+# time each call to `fn`, from within a single moment
+function time_calls(fn,times)
+  moment() do
+    for i in 1:n_samples
+      started = Weber.precise_time()
+      fn(i)
+      push!(times,Weber.precise_time() - started)
+    end
+  end
+end
+
+# the latency of each moment: the time it ran, less the time it should have run
+# (as measured by the experiment, see `Weber.run_stats`).
+const onset_delay = 0.05
+function moment_onset()
+  exp = Experiment(null_window=!use_sdl,hide_output=true)
+  setup(exp) do
+    addtrial([moment(onset_delay,() -> nothing) for i in 1:n_samples])
+  end
+  run(exp,await_input=false)
+  Weber.run_stats(exp).moments[Weber.TimedMoment]
+end
+
+# With a null window `record` keeps each row in memory and never touches the
+# data file, so the record benchmarks write rows through a `RecordBuffer`
+# directly, the way `record` does with a real window.
+const record_columns = [:offset,:trial,:time,:code,:value]
+function record_benchmark(fn,format)
+  dir = mktempdir()
+  try
+    fmt = Weber.data_format(format)
+    file = joinpath(dir,"benchmark"*Weber.file_extension(fmt))
+    plan = Weber.compile!(Weber.RecordPlan(),record_columns,[])
+    buffer = Weber.RecordBuffer(Nullable(file),fmt)
+    Weber.open_records!(buffer,plan.columns)
+    times = fn(plan,buffer)
+    Weber.close_records!(buffer)
+
+    rows = recorded_rows(file,fmt)
+    if rows != length(times)
+      error("Expected $(length(times)) rows in the benchmark data file, "*
+            "found $rows.")
+    end
+    times
+  finally
+    rm(dir,recursive=true)
+  end
+end
+recorded_rows(file,::Weber.CSVFormat) = countlines(file) - 1
+recorded_rows(file,::Weber.BinaryFormat) = length(read_binary_data(file)[2])
+
+# the steps `record` takes to store a row in the buffer
+function buffer_row!(plan,buffer,i)
+  row = Weber.next_row!(buffer,length(plan.columns))
+  copy!(row,plan.fixed)
+  row[plan.offset_slot] = 0
+  row[plan.trial_slot] = 0
+  row[plan.time_slot] = Weber.precise_time()
+  row[plan.code_slot] = "benchmark"
+  row[plan.slots[:value]] = i
+  Weber.freeze_row!(row)
+  Weber.commit_record!(buffer,"benchmark")
+end
+
+record_cost(format) = record_benchmark(format) do plan,buffer
+  map(1:n_samples) do i
+    started = Weber.precise_time()
+    buffer_row!(plan,buffer,i)
+    Weber.precise_time() - started
+  end
+end
+
+# the time taken to write a buffered row to the data file, which happens when
+# the run loop is idle
+flush_cost(format) = record_benchmark(format) do plan,buffer
+  map(1:n_samples) do i
+    buffer_row!(plan,buffer,i)
+    started = Weber.precise_time()
+    Weber.flush_records!(buffer)
+    Weber.precise_time() - started
+  end
+end
+
+poll_events_cost() = run_benchmark() do times
+  addtrial(time_calls(times) do i
+    Weber.poll_events((exp,event) -> nothing,Weber.get_experiment(),0.0)
+  end)
+end
+
+# the time taken to draw the display stack, not counting the time spent
+# presenting the frame (which waits for the vertical refresh)
+draw_stack_time() = run_benchmark() do times
+  visuals = [visual("benchmark"),visual(colorant"black")]
+  addtrial(moment() do
+    present = Weber.run_stats().present
+    for i in 1:n_samples
+      presenting = present.total
+      started = Weber.precise_time()
+      display(visuals[mod1(i,2)])
+      push!(times,Weber.precise_time() - started - (present.total - presenting))
+    end
+  end)
+end
+
+function adapter_update(adapter)
+  map(1:n_samples) do i
+    started = Weber.precise_time()
+    update!(adapter,rand(Bool),true)
+    Weber.precise_time() - started
+  end
+end
+
+benchmarks = [("moment_onset",moment_onset),
+              ("record",() -> record_cost(:csv)),
+              ("record_binary",() -> record_cost(:binary)),
+              ("record_flush",() -> flush_cost(:csv)),
+              ("record_flush_binary",() -> flush_cost(:binary)),
+              ("levitt_update",() -> adapter_update(levitt_adapter())),
+              ("bayesian_update",() -> adapter_update(bayesian_adapter()))]
+if use_sdl
+  push!(benchmarks,("poll_events",poll_events_cost),
+        ("draw_stack",draw_stack_time))
+end
+
+# a benchmark reports either each time it measured, or a histogram of them
+sorted(times::Vector) = sort!(times)
+sorted(times::Weber.LatencyHistogram) = times
+sample_count(times::Vector) = length(times)
+sample_count(times::Weber.LatencyHistogram) = times.n
+
+const percentiles = [0.5,0.9,0.99,1.0]
+results = map(benchmarks) do benchmark
+  name,fn = benchmark
+  info("Running $name benchmark...")
+  fn() # compile everything the benchmark uses, before timing it
+  name => sorted(fn())
+end
+
+thresholds,_ = readdlm(args["thresholds"],',',header=true)
+failures = String[]
+for i in 1:size(thresholds,1)
+  name,win,p,max_seconds = thresholds[i,:]
+  win == window_name || continue
+  for (bname,times) in results
+    bname == name || continue
+    t = quantile(times,p)
+    if t > max_seconds
+      push!(failures,"$name: the $(100p)th percentile took $t seconds "*
+            "(expected less than $max_seconds seconds).")
+    end
+  end
+end
+
+open(args["output"],"w") do io
+  println(io,"benchmark,window,samples,p50,p90,p99,max,weber_version,",
+          "julia_version")
+  for (name,times) in results
+    println(io,join([name,window_name,sample_count(times),
+                     [quantile(times,p) for p in percentiles]...,
+                     Weber.version,VERSION],","))
+  end
+end
+info("Benchmark results written to $(abspath(args["output"])).")
+
+if !isempty(failures)
+  foreach(warn,failures)
+  error("$(length(failures)) benchmark threshold(s) were exceeded.")
+end
@@ -0,0 +1,103 @@
+using ArgParse
+using SnoopCompile
+
+# HOW TO USE: run this script on the machine where experiments will be run,
+# after installing (or updating) Weber.
+#
+#     julia deps/build_sysimg.jl [--precompile-only] [experiment.jl...]
+#
+# This runs deps/snoop_workload.jl, and each of the given experiment scripts
+# (with the arguments "test" and "0"), while recording every method Julia
+# compiles. You will need to complete each of these experiments (or end them
+# by pressing escape and then return).
+#
+# By default the result is a custom system image, which includes Weber, its
+# dependencies and the compiled methods. Run experiments using this image,
+# and they will start without any delay to compile Weber:
+#
+#     julia -J deps/usr/lib/weber_sys.<so,dylib,dll> experiment.jl
+#
+# With --precompile-only, src/precompile.jl is regenerated instead, so that
+# the compiled methods are stored in Weber's precompile cache. This is less
+# effective, but does not require a separate system image.
+
+settings = ArgParseSettings(description="Build a system image for Weber.")
+@add_arg_table settings begin
+  "--precompile-only"
+    help = "only regenerate src/precompile.jl"
+    action = :store_true
+  "--output"
+    help = "the system image to create (with no file extension)"
+    default = joinpath(@__DIR__,"usr","lib","weber_sys")
+  "scripts"
+    help = "experiment scripts to run while recording compiled methods"
+    nargs = '*'
+end
+args = parse_args(settings)
+
+dir = mktempdir()
+scripts = [joinpath(@__DIR__,"snoop_workload.jl"); abspath.(args["scripts"])]
+
+compiled = map(enumerate(scripts)) do i_script
+  i,script = i_script
+  csv = joinpath(dir,"compiles_$i.csv")
+  info("Recording the methods compiled by $script...")
+  @eval SnoopCompile.@snoop $csv begin
+    ARGS = ["test","0"]
+    include($script)
+  end
+
+  # some signatures are written in a form that can't be read back in, these
+  # are dropped (previously they had to be deleted by hand)
+  lines = filter(readlines(csv)) do line
+    fields = split(line,'\t')
+    length(fields) == 2 || return false
+    try
+      parse(fields[2])
+      true
+    catch
+      false
+    end
+  end
+  clean = joinpath(dir,"clean_compiles_$i.csv")
+  open(io -> foreach(l -> println(io,l),lines),clean,"w")
+  SnoopCompile.read(clean)
+end
+data = vcat(compiled...)
+
+packages,_ = SnoopCompile.parcel(data[end:-1:1,2])
+SnoopCompile.write(dir,packages)
+
+if args["precompile-only"]
+  file = joinpath(@__DIR__,"..","src","precompile.jl")
+  open(file,"w") do io
+    println(io,"# generated by deps/build_sysimg.jl --precompile-only")
+    write(io,readstring(joinpath(dir,"precompile_Weber.jl")))
+  end
+  info("Regenerated $(abspath(file)).")
+else
+  userimg = joinpath(dir,"userimg.jl")
+  open(userimg,"w") do io
+    println(io,"Base.require(:Weber)")
+    # tells Weber that it doesn't need to warm up before each experiment
+    println(io,"Base.root_module(:Weber).warmed_up[] = true")
+    for mod in keys(packages)
+      mod ∈ [:Main,:Core] && continue
+      file = joinpath(dir,"precompile_$mod.jl")
+      println(io,"""
+      try
+        let m = Base.root_module(:$mod)
+          eval(m,:(include($(repr(file)))))
+          eval(m,:(_precompile_()))
+        end
+      catch e
+        warn("Skipping methods compiled for $mod: ",e)
+      end""")
+    end
+  end
+
+  include(joinpath(JULIA_HOME,Base.DATAROOTDIR,"julia","build_sysimg.jl"))
+  mkpath(dirname(args["output"]))
+  build_sysimg(args["output"],"native",userimg,force=true)
+  info("Run experiments with `julia -J $(args["output"]).$(Libdl.dlext)`.")
+end
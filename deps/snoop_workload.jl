@@ -0,0 +1,28 @@
+using Weber
+
+# The parts of Weber a typical experiment uses while it runs: recording,
+# moments of each kind, displaying visuals and playing sounds. This is run by
+# build_sysimg.jl while it records which methods are compiled, so it uses a
+# real window and real sounds.
+
+sound = ramp(tone(1kHz,50ms))
+exp = Experiment(debug=true,hide_output=true,data_dir=nothing,
+                 columns=[:label])
+setup(exp) do
+  addbreak(moment(display,"Compiling Weber..."),moment(250ms))
+  for i in 1:3
+    addtrial(show_cross(),
+             moment(100ms,play,sound),
+             moment(100ms,play,() -> ramp(tone(rand(500:1000)*Hz,50ms))),
+             moment(display,"Trial $i"),
+             moment(display,() -> "Trial $i, again"),
+             timeout(() -> record("timeout",label=i),iskeydown,100ms),
+             moment(50ms,record,"done",label=i))
+  end
+  @addtrials let i = 0
+    @addtrials while i < 2
+      addtrial(moment(() -> i += 1),moment(10ms,record,"looped",label=i))
+    end
+  end
+end
+run(exp,await_input=false)
@@ -73,8 +73,19 @@ TTF_GetError = SDL_GetError
 # offset of various fields in the data using offsetof(struct,field) in c and
 # then using that offset to access the memory in julia. SDL's
 # core event type (SDL_Event) is a c union.
-function at{T}(x::Ptr{Void},::Type{T},offset)
-  unsafe_wrap(Array,reinterpret(Ptr{T},x + offset),1)[1]
+@inline function at{T}(x::Ptr{Void},::Type{T},offset)
+  unsafe_load(Ptr{T}(x + offset))
+end
+
+# run `fn` while holding the lock `l`, used to guard the caches that are shared
+# by all experiments
+function with_lock(fn,l)
+  lock(l)
+  try
+    fn()
+  finally
+    unlock(l)
+  end
 end
 
 import FileIO: load, save
@@ -86,13 +97,23 @@ sdl_is_setup[] = false
 include(joinpath(@__DIR__,"timing.jl"))
 include(joinpath(@__DIR__,"video.jl"))
 
-function resize_cache!(size)
-  resize!(image_cache,size)
-  resize!(convert_cache,size)
+"""
+    resize_cache!(bytes)
+
+Set the maximum amount of memory, in bytes, used to cache images (see
+[`visual`](@ref)). This counts both the memory used to store each image, and
+the memory used by its texture. The least recently used images are removed
+first. By default up to 512 MiB is used.
+"""
+function resize_cache!(bytes)
+  resize!(_image_cache,bytes)
+  nothing
 end
 
+include(joinpath(@__DIR__,"data_file.jl"))
 include(joinpath(@__DIR__,"types.jl"))
 include(joinpath(@__DIR__,"sound_hooks.jl"))
+include(joinpath(@__DIR__,"stream.jl"))
 include(joinpath(@__DIR__,"event.jl"))
 include(joinpath(@__DIR__,"trial.jl"))
 include(joinpath(@__DIR__,"experiment.jl"))
@@ -100,6 +121,7 @@ include(joinpath(@__DIR__,"experiment.jl"))
 include(joinpath(@__DIR__,"primitives.jl"))
 include(joinpath(@__DIR__,"helpers.jl"))
 include(joinpath(@__DIR__,"adaptive.jl"))
+include(joinpath(@__DIR__,"simulate.jl"))
 
 include(joinpath(@__DIR__,"precompile.jl"))
 
@@ -109,6 +131,7 @@ include(joinpath(@__DIR__,"extensions.jl"))
 const localunits = Unitful.basefactors
 const localpromotion = Unitful.promotion
 function __init__()
+  main_task[] = current_task()
   _precompile_()
   merge!(Unitful.basefactors,localunits)
   merge!(Unitful.promotion, localpromotion)
@@ -1,6 +1,6 @@
 using Distributions
 export levitt_adapter, bayesian_adapter, constant_adapter, delta, estimate,
-  update!
+  update!, interleaved_adapter, current_track
 
 abstract type Adapter end
 
@@ -60,7 +60,8 @@ provided response, and the correct response.
   defaults to "Wrong!").
 
 Any additional keyword arguments are added as column values when the
-response is recorded.
+response is recorded. Responses to an [`interleaved_adapter`](@ref) also record
+the index of the track they update, in the "track" column.
 
 """
 function response(track::Adapter,resp::Pair...;keys...)
@@ -73,6 +74,7 @@ function response(callback::Function,adapter::Adapter,responses::Pair...;
                   keys...)
   addcolumn(:correct)
   addcolumn(:delta)
+  foreach(addcolumn,response_columns(adapter))
 
   if correct ∉ map(x -> x[2],responses)
     error("The value of `correct` must be "*
@@ -86,7 +88,8 @@ function response(callback::Function,adapter::Adapter,responses::Pair...;
         if iskeydown(event,key)
           if !responded
             responded = true
-            record(resp;correct=correct,delta=delta(adapter),keys...)
+            record(resp;correct=correct,delta=delta(adapter),
+                   response_values(adapter)...,keys...)
 
             update!(adapter,resp,correct)
             callback(resp,correct)
@@ -103,7 +106,11 @@ function response(callback::Function,adapter::Adapter,responses::Pair...;
   end
 end
 
-mutable struct ConstantStimulus
+# additional columns recorded with each response to an adapter, and their values
+response_columns(adapter::Adapter) = ()
+response_values(adapter::Adapter) = ()
+
+mutable struct ConstantStimulus <: Adapter
   stimuli::Vector{Float64}
   index::Int
   correct::Vector{Int}
@@ -124,7 +131,7 @@ constant stimuli or some kind of adaptive procedure.
 constant_adapter(stimuli) = ConstantStimulus(stimuli,1,Int[],Int[])
 delta(adapter::ConstantStimulus) = adapter.stimuli[adapter.index]
 function update!(adapter::ConstantStimulus,response,correct)
-  adapte.index += 1
+  adapter.index += 1
   nothing
   # push!(adapter.correct,correct)
   # push!(adapter.response,response)
@@ -285,6 +292,13 @@ type ImportanceSampler <: Adapter
   theta_samples::Vector{Float64}
   inv_slope_samples::Vector{Float64}
   thresh_weights::Vector{Float64}
+  log_weights::Vector{Float64}
+  entropies::Vector{Float64}
+  candidates::Vector{Int}
+  sampled::Bool
+  threaded::Bool
+  incremental::Bool
+  ess_threshold::Float64
 
   repeat2_thresh::Float64
   repeat3_thresh::Float64
@@ -307,7 +321,9 @@ end
                                min_delta,max_delta),
                           inv_slope_prior=TruncatedNormal(0,0.25,0,Inf),
                           thresh_d=thresh_prior,
-                          inv_slope_d=inv_slope_prior)
+                          inv_slope_d=inv_slope_prior,
+                          threaded=false,incremental=false,
+                          ess_threshold=0.5,n_candidates=n_samples)
 
 An adapter that finds a threshold according to a parametric statistical
 model. This makes more explicit assumptions than the [`levitt_adapter`](@ref)
@@ -344,6 +360,19 @@ to have any repeats, both values can be set to Inf.
 - **first_delta**: the delta to start measuring with
 - **n_samples** the number of samples to use during importance sampling.
   The algorithm for selecting new deltas is O(n²).
+- **threaded** if true, the entropy of each sample is computed in parallel,
+  using all available threads (see `Threads.nthreads`).
+- **incremental** if true, the samples are kept across trials, and their
+  weights are updated using only the latest response. When the effective
+  sample size falls below `ess_threshold` (as a proportion of `n_samples`)
+  the samples are resampled in proportion to their weights, and jittered to
+  keep them diverse. This makes the time to update the adapter independent of
+  the number of trials run so far.
+- **ess_threshold** the proportion of `n_samples` below which the effective
+  sample size must fall before resampling (only used when `incremental` is true).
+- **n_candidates** the number of samples considered as the next delta. Each
+  candidate's entropy is O(n), so, for large values of `n_samples`, a smaller
+  value of `n_candidates` will considerably speed up delta selection.
 - **miss** the expected rate at which listeners will make mistakes
   even for easy to percieve differences.
 - **threshold** the %-response threshold to be estimated
@@ -382,61 +411,203 @@ function bayesian_adapter(;first_delta=0.1,
                           inv_slope_prior=
                           TruncatedNormal(0,2max_plausible_delta,0,Inf),
                           thresh_d=thresh_prior,
-                          inv_slope_d=inv_slope_prior)
+                          inv_slope_d=inv_slope_prior,
+                          threaded=false,incremental=false,
+                          ess_threshold=0.5,n_candidates=n_samples)
   delta = first_delta
   delta_repeat = 0
   resp = Dict{Float64,Int}()
   N = Dict{Float64,Int}()
-  samples = ones(0)
-  weights = ones(0)
+  buffer() = Vector{Float64}(n_samples)
+  # the candidates are evenly spaced across the samples, which are drawn
+  # independently of one another
+  candidates = collect(round.(Int,linspace(1,n_samples,
+                                           min(n_candidates,n_samples))))
   ImportanceSampler(miss,threshold,thresh_d,inv_slope_d,n_samples,
                     thresh_prior,inv_slope_prior,
                     delta,min_delta,max_delta,delta_repeat,
-                    resp,N,samples,samples,samples,weights,
+                    resp,N,buffer(),buffer(),buffer(),buffer(),buffer(),
+                    Vector{Float64}(length(candidates)),candidates,
+                    false,threaded,incremental,ess_threshold,
                     repeat3_thresh,repeat2_thresh)
 end
 
 const sqrt_2 = sqrt(2)
+
+# the psychometric function, f(Δ), for a given threshold and inverse slope
+@inline function psychometric(miss,delta,theta,inv_slope)
+  x = exp((delta - theta)/inv_slope)/sqrt_2
+  (miss/2) + (1-miss)*0.5erfc(-x/sqrt_2)
+end
+
 function sample(a::ImportanceSampler)
-  if length(a.thresh_samples) == 0
-    theta = rand(a.thresh_d,a.n_samples)
-    inv_slope = rand(a.inv_slope_d,a.n_samples)
-    q_log_prob = logpdf(a.thresh_d,theta) .+ logpdf(a.inv_slope_d,inv_slope)
+  if !a.sampled
+    theta = rand!(a.thresh_d,a.theta_samples)
+    inv_slope = rand!(a.inv_slope_d,a.inv_slope_samples)
 
     udeltas = collect(keys(a.resp))
-    x = exp((udeltas' .- theta)./inv_slope)/sqrt_2
-    p = (a.miss/2) + (1-a.miss)*cdf(Normal(),x)
-    log_prob = sum(enumerate(udeltas)) do x
-      i,delta = x
-      logpdf.(Binomial.(a.N[delta],p[:,i]),a.resp[delta])
-    end + logpdf(a.theta_prior,theta) + logpdf(a.inv_slope_prior,inv_slope)
-
-    lweights = log_prob - q_log_prob
-    weights = exp.(lweights - maximum(lweights))
-    weights = weights ./ sum(weights)
-    ess = 1 / sum(weights.^2)
-
-    # if ess / length(weights) < 0.1
+    ns = Int[a.N[delta] for delta in udeltas]
+    ks = Int[a.resp[delta] for delta in udeltas]
+
+    # the binomial coefficients of the likelihood are the same for all samples,
+    # and drop out when the weights are normalized.
+    lweights = a.log_weights
+    for j in eachindex(theta)
+      log_prob = logpdf(a.theta_prior,theta[j]) +
+        logpdf(a.inv_slope_prior,inv_slope[j]) -
+        logpdf(a.thresh_d,theta[j]) - logpdf(a.inv_slope_d,inv_slope[j])
+      for i in eachindex(udeltas)
+        p = psychometric(a.miss,udeltas[i],theta[j],inv_slope[j])
+        log_prob += ks[i]*log(p) + (ns[i]-ks[i])*log(1-p)
+      end
+      lweights[j] = log_prob
+    end
+
+    normalize_weights!(a)
+    # if ess(a.thresh_weights) / length(weights) < 0.1
     #   warn("Effective sampling size of importance samples is low ",
     #        "($(round(ess,1))). Consider adjusting the `thresh_d` and `slope_d`.")
     #   record("poor_adaptor_ess",value=ess)
     # end
 
-    dprime = invlogcdf(Normal(),log((a.threshold-a.miss/2)/(1-a.miss)))
-    thresh_off = -log(dprime).*inv_slope
-    a.theta_samples = theta
-    a.inv_slope_samples = inv_slope
-    a.thresh_samples = theta + thresh_off
-    a.thresh_weights = weights
+    update_thresholds!(a)
+    a.sampled = true
   end
   a.thresh_samples, a.thresh_weights
 end
 
+function normalize_weights!(a::ImportanceSampler)
+  lweights,weights = a.log_weights,a.thresh_weights
+  max_lweight = maximum(lweights)
+  @simd for j in eachindex(weights)
+    @inbounds lweights[j] -= max_lweight
+    @inbounds weights[j] = exp(lweights[j])
+  end
+  scale!(weights,1/sum(weights))
+end
+
+ess(weights) = 1 / sum(w -> w^2,weights)
+
+function update_thresholds!(a::ImportanceSampler)
+  dprime = invlogcdf(Normal(),log((a.threshold-a.miss/2)/(1-a.miss)))
+  log_dprime = log(dprime)
+  theta,inv_slope = a.theta_samples,a.inv_slope_samples
+  @simd for j in eachindex(theta)
+    @inbounds a.thresh_samples[j] = theta[j] - log_dprime*inv_slope[j]
+  end
+end
+
+# update the weights of the existing samples given a single new response
+function observe!(a::ImportanceSampler,delta,correct)
+  theta,inv_slope,lweights = a.theta_samples,a.inv_slope_samples,a.log_weights
+  for j in eachindex(theta)
+    p = psychometric(a.miss,delta,theta[j],inv_slope[j])
+    lweights[j] += correct ? log(p) : log(1-p)
+  end
+  normalize_weights!(a)
+
+  if ess(a.thresh_weights) < a.ess_threshold*a.n_samples
+    resample!(a)
+  end
+  update_thresholds!(a)
+end
+
+# the discount factor used to jitter the samples during resampling (see Liu &
+# West, 2001): the samples shrink towards their mean, and are then perturbed,
+# so that their mean and variance are preserved.
+const jitter_discount = 0.98
+
+function resample!(a::ImportanceSampler)
+  theta,inv_slope,weights = a.theta_samples,a.inv_slope_samples,a.thresh_weights
+  shrink = (3jitter_discount - 1) / (2jitter_discount)
+  jitter = sqrt(1 - shrink^2)
+  theta_μ,theta_σ = mean_and_std(theta,weights)
+  inv_slope_μ,inv_slope_σ = mean_and_std(inv_slope,weights)
+
+  # systematic resampling: the threshold and log weight buffers are free to
+  # use as scratch space, as both are reset below.
+  old_theta,old_inv_slope = a.thresh_samples,a.log_weights
+  copy!(old_theta,theta)
+  copy!(old_inv_slope,inv_slope)
+  n = length(weights)
+  u = rand()/n
+  total = weights[1]
+  k = 1
+  for j in 1:n
+    while total < u && k < n
+      k += 1
+      total += weights[k]
+    end
+    theta[j] = old_theta[k]
+    inv_slope[j] = old_inv_slope[k]
+    u += 1/n
+  end
+
+  for j in 1:n
+    new_theta = shrink*theta[j] + (1-shrink)*theta_μ + jitter*theta_σ*randn()
+    if isfinite(logpdf(a.theta_prior,new_theta))
+      theta[j] = new_theta
+    end
+    new_inv_slope = shrink*inv_slope[j] + (1-shrink)*inv_slope_μ +
+      jitter*inv_slope_σ*randn()
+    if isfinite(logpdf(a.inv_slope_prior,new_inv_slope))
+      inv_slope[j] = new_inv_slope
+    end
+  end
+
+  fill!(a.log_weights,0.0)
+  fill!(weights,1/n)
+end
+
+function mean_and_std(xs,weights)
+  μ = sum(xs[j]*weights[j] for j in eachindex(xs))
+  μ,sqrt(sum(weights[j]*(xs[j]-μ)^2 for j in eachindex(xs)))
+end
+
+# the (negative) expected entropy of a response to each threshold sample,
+# weighted by the sample's importance weight.
+@inline function sample_entropy(j,thresh,theta,inv_slope,weights,miss)
+  @inbounds begin
+    theta_j,inv_slope_j = theta[j],inv_slope[j]
+    total = 0.0
+    @simd for i in eachindex(thresh)
+      p = psychometric(miss,thresh[i],theta_j,inv_slope_j)
+      total += p*log(p) + (1-p)*log(1-p)
+    end
+    -total*weights[j]
+  end
+end
+
+function entropies!(a::ImportanceSampler)
+  entropies!(a.entropies,a.candidates,a.thresh_samples,a.theta_samples,
+             a.inv_slope_samples,a.thresh_weights,a.miss,a.threaded)
+end
+
+function entropies!(entropies,candidates,thresh,theta,inv_slope,weights,miss,
+                    threaded)
+  if threaded
+    Threads.@threads for c in 1:length(candidates)
+      entropies[c] = sample_entropy(candidates[c],thresh,theta,inv_slope,
+                                    weights,miss)
+    end
+  else
+    for c in eachindex(candidates)
+      entropies[c] = sample_entropy(candidates[c],thresh,theta,inv_slope,
+                                    weights,miss)
+    end
+  end
+  entropies
+end
+
 function update!(adapter::ImportanceSampler,response,correct)
-  adapter.thresh_samples = ones(0)
   adapter.resp[adapter.delta] = get(adapter.resp,adapter.delta,0) +
     (response==correct)
   adapter.N[adapter.delta] = get(adapter.N,adapter.delta,0) + 1
+  if adapter.incremental && adapter.sampled
+    observe!(adapter,adapter.delta,response==correct)
+  else
+    adapter.sampled = false
+  end
 
   thresh,weights = sample(adapter)
   μ,σ = estimate(adapter)
@@ -459,16 +630,9 @@ function update!(adapter::ImportanceSampler,response,correct)
     # sized array
     # TODO: debug selection
 
-    entropies = -sum(1:adapter.n_samples) do i
-      diff = adapter.thresh_samples[i] .- adapter.theta_samples
-      dprime = exp(diff./adapter.inv_slope_samples)/sqrt_2
-      p = ((adapter.miss/2) + (1-adapter.miss)*cdf(Normal(),dprime))
-      (p .* log(p) + (1-p) .* log(1-p)) .* weights
-    end
+    _,i = findmax(entropies!(adapter))
 
-    _,i = findmax(entropies)
-
-    adapter.delta = adapter.thresh_samples[i]
+    adapter.delta = adapter.thresh_samples[adapter.candidates[i]]
   end
 
   adapter
@@ -486,3 +650,100 @@ end
 
 delta(adapter::ImportanceSampler) = bound(adapter.delta,adapter.min_delta,
 adapter.max_delta)
+
+mutable struct InterleavedAdapter <: Adapter
+  tracks::Vector{Adapter}
+  order::Symbol
+  index::Int
+  deferred::Bool
+  pending::Nullable{Tuple{Any,Any}}
+end
+
+"""
+    interleaved_adapter(tracks...;[order=:round_robin],[deferred=true])
+
+An adapter that interleaves several adaptive tracks (e.g. created by
+[`levitt_adapter`](@ref) or [`bayesian_adapter`](@ref)). Each call to
+[`delta`](@ref) returns the delta of the current track, and each response
+updates the current track, after which the next track is selected according
+to `order`.
+
+- `:round_robin` cycles through the tracks in order
+- `:random` selects a track at random
+- `:uncertainty` selects the track whose threshold estimate has the largest
+  ratio of standard deviation to mean (see [`estimate`](@ref)). Tracks without
+  an estimate yet are selected first.
+
+When `deferred` is true, the update to an adapter during a response is postponed
+until the run loop is idle (e.g. while the next stimulus is playing), and is
+only run immediately if `delta` is called before then. This keeps a slow
+update (such as that of `bayesian_adapter`) from delaying the moments that
+follow a response.
+
+Use [`current_track`](@ref) to determine which track is currently presented.
+Each response (see [`response`](@ref)) records the track it updates in the
+"track" column. The `estimate` of an interleaved adapter is the mean and error of
+each track's estimate, as two vectors.
+"""
+function interleaved_adapter(tracks::Adapter...;order=:round_robin,
+                             deferred=true)
+  if order ∉ [:round_robin,:random,:uncertainty]
+    error("Unknown track order `$order`, expected :round_robin, :random or ",
+          ":uncertainty.")
+  end
+  InterleavedAdapter(collect(Adapter,tracks),order,1,deferred,Nullable())
+end
+
+"""
+    current_track(adapter)
+
+Returns the index of the track that will be presented next by an
+[`interleaved_adapter`](@ref).
+"""
+current_track(adapter::InterleavedAdapter) = (finish_update!(adapter); adapter.index)
+
+response_columns(adapter::InterleavedAdapter) = (:track,)
+response_values(adapter::InterleavedAdapter) = (:track => current_track(adapter),)
+
+function delta(adapter::InterleavedAdapter)
+  finish_update!(adapter)
+  delta(adapter.tracks[adapter.index])
+end
+
+function update!(adapter::InterleavedAdapter,response,correct)
+  finish_update!(adapter)
+  adapter.pending = Nullable((response,correct))
+  if adapter.deferred && in_experiment()
+    defer(() -> (finish_update!(adapter); true))
+  else
+    finish_update!(adapter)
+  end
+  adapter
+end
+
+function finish_update!(adapter::InterleavedAdapter)
+  if !isnull(adapter.pending)
+    response,correct = get(adapter.pending)
+    adapter.pending = Nullable()
+    update!(adapter.tracks[adapter.index],response,correct)
+    adapter.index = next_track(adapter,Val{adapter.order})
+  end
+  adapter
+end
+
+next_track(adapter,::Type{Val{:round_robin}}) =
+  mod1(adapter.index+1,length(adapter.tracks))
+next_track(adapter,::Type{Val{:random}}) = rand(1:length(adapter.tracks))
+function next_track(adapter,::Type{Val{:uncertainty}})
+  _,i = findmax(map(adapter.tracks) do track
+    μ,σ = estimate(track)
+    isnan(σ) ? Inf : σ / abs(μ)
+  end)
+  i
+end
+
+function estimate(adapter::InterleavedAdapter)
+  finish_update!(adapter)
+  estimates = map(estimate,adapter.tracks)
+  map(first,estimates),map(last,estimates)
+end
@@ -0,0 +1,359 @@
+export read_binary_data, binary_to_csv
+
+# The data file is written through a persistent buffer: calls to `record` only
+# store the row in memory, and the rows are written to disk in between moments
+# (when the run loop has time to spare). This keeps file system calls out of
+# the timing critical parts of an experiment.
+
+const record_buffer_size = 256
+
+# codes that mark a point where all rows should be safely stored on disk: the
+# trial boundaries are synced the next time the run loop is idle, the exit codes
+# are synced immediately.
+const record_sync_codes = Set(["trial_start","practice_start","break_start"])
+const record_exit_codes = Set(["closed","terminated"])
+
+# the layout of a row in the data file, determined once, when the header is
+# written. Each column is assigned a fixed slot in the row so that `record` can
+# fill in a row using direct, indexed writes.
+mutable struct RecordPlan
+  compiled::Bool
+  columns::Vector{Symbol}
+  slots::Dict{Symbol,Int}
+  fixed::Vector{Any}
+  scratch::Vector{Any}
+  offset_slot::Int
+  trial_slot::Int
+  time_slot::Int
+  code_slot::Int
+end
+RecordPlan() = RecordPlan(false,Symbol[],Dict{Symbol,Int}(),Any[],Any[],0,0,0,0)
+
+function compile!(plan::RecordPlan,columns::Vector{Symbol},fixed)
+  plan.columns = columns
+  plan.slots = Dict{Symbol,Int}()
+  for (i,c) in enumerate(columns)
+    # the first column of a given name is the one that gets written
+    get!(plan.slots,c,i)
+  end
+
+  plan.fixed = fill!(Vector{Any}(length(columns)),"")
+  for (c,v) in fixed
+    plan.fixed[plan.slots[c]] = v
+  end
+  plan.scratch = copy(plan.fixed)
+
+  plan.offset_slot = plan.slots[:offset]
+  plan.trial_slot = plan.slots[:trial]
+  plan.time_slot = plan.slots[:time]
+  plan.code_slot = plan.slots[:code]
+  plan.compiled = true
+
+  plan
+end
+
+function unknown_columns_error(plan::RecordPlan,kwds)
+  missing = unique(collect(k for (k,v) in kwds if !haskey(plan.slots,k)))
+  error("Unexpected column $(length(missing) > 1 ? "s" : "")"*
+        "$(join(missing,", "," and ")). "*
+        "Make sure you specify all columns you plan to use "*
+        "during experiment initialization.")
+end
+
+abstract type DataFormat end
+struct CSVFormat <: DataFormat end
+struct BinaryFormat <: DataFormat
+  row::IOBuffer
+end
+BinaryFormat() = BinaryFormat(IOBuffer())
+
+function data_format(format::Symbol)
+  if format == :csv
+    CSVFormat()
+  elseif format == :binary
+    BinaryFormat()
+  else
+    error("Unknown data format `$format`, expected :csv or :binary.")
+  end
+end
+file_extension(::CSVFormat) = ".csv"
+file_extension(::BinaryFormat) = ".wlog"
+
+# rows are allocated once, and reused each time the buffer is written to disk.
+mutable struct RecordBuffer
+  file::Nullable{String}
+  format::DataFormat
+  stream::Nullable{IOStream}
+  rows::Vector{Vector{Any}}
+  n_rows::Int
+  capacity::Int
+  sync_requested::Bool
+end
+
+function RecordBuffer(file::Nullable{String},format=CSVFormat(),
+                      capacity=record_buffer_size)
+  rows = Vector{Vector{Any}}()
+  sizehint!(rows,capacity)
+  RecordBuffer(file,format,Nullable{IOStream}(),rows,0,capacity,false)
+end
+
+@static if is_windows()
+  fsync_fd(fd) = ccall(:_commit,Cint,(Cint,),fd)
+else
+  fsync_fd(fd) = ccall(:fsync,Cint,(Cint,),fd)
+end
+
+function open_records!(buffer::RecordBuffer,columns)
+  if !isnull(buffer.file)
+    stream = open(get(buffer.file),"w")
+    write_header(stream,buffer.format,columns)
+    buffer.stream = Nullable(stream)
+
+    for i in (length(buffer.rows)+1):buffer.capacity
+      push!(buffer.rows,Vector{Any}(length(columns)))
+    end
+  end
+  buffer
+end
+
+# returns the next free row of the buffer, writing rows to disk if all rows
+# are in use
+function next_row!(buffer::RecordBuffer,ncolumns)
+  if buffer.n_rows >= buffer.capacity
+    # if the run loop never had time to write the rows out we have to do it
+    # now, otherwise records would be lost.
+    flush_records!(buffer)
+  end
+
+  buffer.n_rows += 1
+  if buffer.n_rows > length(buffer.rows)
+    push!(buffer.rows,Vector{Any}(ncolumns))
+  end
+  row = buffer.rows[buffer.n_rows]
+  if length(row) != ncolumns
+    resize!(row,ncolumns)
+  end
+  row
+end
+
+# buffered rows are written after `record` returns, so mutable values (such as
+# arrays) are converted to strings, as they will be written, when the row is
+# recorded: changing the value afterwards doesn't change the row.
+function freeze_row!(row)
+  @inbounds for i in eachindex(row)
+    row[i] = frozen_value(row[i])
+  end
+  row
+end
+frozen_value(x::Union{String,Symbol}) = x
+frozen_value(x) = isbits(typeof(x)) ? x : string(x)
+
+function commit_record!(buffer::RecordBuffer,code)
+  code = string(code)
+  if code ∈ record_exit_codes
+    sync_records!(buffer)
+  elseif code ∈ record_sync_codes
+    buffer.sync_requested = true
+  end
+  buffer
+end
+
+function flush_records!(buffer::RecordBuffer)
+  if buffer.n_rows > 0
+    if isnull(buffer.stream)
+      buffer.stream = Nullable(open(get(buffer.file),"a"))
+    end
+    stream = get(buffer.stream)
+    for i in 1:buffer.n_rows
+      write_row(stream,buffer.format,buffer.rows[i])
+    end
+    buffer.n_rows = 0
+  end
+
+  if buffer.sync_requested
+    sync_records!(buffer)
+  end
+  buffer
+end
+
+function sync_records!(buffer::RecordBuffer)
+  buffer.sync_requested = false
+  flush_records!(buffer)
+  if !isnull(buffer.stream)
+    stream = get(buffer.stream)
+    flush(stream)
+    fsync_fd(Cint(fd(stream)))
+  end
+  buffer
+end
+
+function close_records!(buffer::RecordBuffer)
+  sync_records!(buffer)
+  if !isnull(buffer.stream)
+    close(get(buffer.stream))
+    buffer.stream = Nullable{IOStream}()
+  end
+  buffer
+end
+
+################################################################################
+# CSV files
+
+write_header(io::IO,::CSVFormat,columns) = println(io,join(columns,","))
+function write_row(io::IO,::CSVFormat,row)
+  join(io,(string(x) for x in row),",")
+  println(io)
+end
+
+################################################################################
+# binary files
+#
+# A binary data file is an append-only log of length-prefixed rows. Values are
+# stored with their type, so that numbers (in particular, times) are written
+# without loss of precision, and can be read without any parsing. All values
+# are little-endian.
+#
+#   file:   "WEBERLOG" version::UInt8 ncolumns::UInt32 column_name... row...
+#   column_name: nbytes::UInt16 utf8 bytes
+#   row:    nbytes::UInt32 value... (one value per column)
+#   value:  tag::UInt8 data
+
+const binary_magic = b"WEBERLOG"
+const binary_version = 0x02 # version 2 adds unsigned integers
+
+const empty_tag = 0x00
+const float_tag = 0x01
+const int_tag = 0x02
+const string_tag = 0x03
+const symbol_tag = 0x04
+const bool_tag = 0x05
+const uint_tag = 0x06
+
+function write_header(io::IO,::BinaryFormat,columns)
+  write(io,binary_magic)
+  write(io,binary_version)
+  write(io,htol(UInt32(length(columns))))
+  for c in columns
+    name = string(c)
+    write(io,htol(UInt16(sizeof(name))))
+    write(io,name)
+  end
+end
+
+write_value(io::IO,x::AbstractFloat) = (write(io,float_tag); write(io,htol(Float64(x))))
+write_value(io::IO,x::Bool) = (write(io,bool_tag); write(io,UInt8(x)))
+write_value(io::IO,x::Unsigned) =
+  x <= typemax(UInt64) ? (write(io,uint_tag); write(io,htol(UInt64(x)))) :
+  write_string(io,string_tag,string(x))
+write_value(io::IO,x::Integer) =
+  typemin(Int64) <= x <= typemax(Int64) ?
+  (write(io,int_tag); write(io,htol(Int64(x)))) :
+  write_string(io,string_tag,string(x))
+write_value(io::IO,x::Symbol) = write_string(io,symbol_tag,string(x))
+function write_value(io::IO,x::AbstractString)
+  isempty(x) ? write(io,empty_tag) : write_string(io,string_tag,x)
+end
+write_value(io::IO,x) = write_string(io,string_tag,string(x))
+function write_string(io::IO,tag::UInt8,x::AbstractString)
+  write(io,tag)
+  write(io,htol(UInt32(sizeof(x))))
+  write(io,x)
+end
+
+function write_row(io::IO,format::BinaryFormat,row)
+  buf = format.row
+  seekstart(buf)
+  truncate(buf,0)
+  for x in row
+    write_value(buf,x)
+  end
+  write(io,htol(UInt32(position(buf))))
+  unsafe_write(io,pointer(buf.data),UInt(position(buf)))
+  nothing
+end
+
+function read_value(io::IO)
+  tag = read(io,UInt8)
+  if tag == empty_tag
+    ""
+  elseif tag == float_tag
+    ltoh(read(io,Float64))
+  elseif tag == int_tag
+    ltoh(read(io,Int64))
+  elseif tag == uint_tag
+    ltoh(read(io,UInt64))
+  elseif tag == bool_tag
+    read(io,UInt8) != 0x00
+  elseif tag == string_tag || tag == symbol_tag
+    str = String(read(io,ltoh(read(io,UInt32))))
+    tag == symbol_tag ? Symbol(str) : str
+  else
+    error("Unknown value tag $tag in binary data file.")
+  end
+end
+
+"""
+    read_binary_data(file)
+
+Read a data file written by an experiment created with `format=:binary` (see
+[`Experiment`](@ref)). Returns the column names and an array of rows, each row
+storing one value for each column.
+
+If the experiment was terminated before the last row could be completely
+written, that row is dropped with a warning.
+"""
+function read_binary_data(file)
+  open(file) do io
+    if read(io,length(binary_magic)) != binary_magic
+      error("The file $file is not a Weber binary data file.")
+    end
+    version = read(io,UInt8)
+    if version > binary_version
+      error("Unsupported version ($version) of the Weber binary data format.")
+    end
+
+    columns = map(1:ltoh(read(io,UInt32))) do i
+      Symbol(String(read(io,ltoh(read(io,UInt16)))))
+    end
+
+    rows = Vector{Vector{Any}}()
+    try
+      while !eof(io)
+        nbytes = ltoh(read(io,UInt32))
+        bytes = read(io,nbytes)
+        length(bytes) < nbytes && throw(EOFError())
+
+        row_io = IOBuffer(bytes)
+        push!(rows,Any[read_value(row_io) for c in columns])
+      end
+    catch e
+      if e isa EOFError
+        warn("The last row of $file is incomplete and has been dropped.")
+      else
+        rethrow(e)
+      end
+    end
+
+    columns,rows
+  end
+end
+
+"""
+    binary_to_csv(file,[csvfile])
+
+Convert a data file written by an experiment created with `format=:binary` (see
+[`Experiment`](@ref)) to a csv file. By default the csv file has the same
+name as `file`, with a .csv extension.
+
+Floating point values are written with full precision.
+"""
+function binary_to_csv(file,csvfile=splitext(file)[1]*".csv")
+  columns,rows = read_binary_data(file)
+  open(csvfile,"w") do io
+    write_header(io,CSVFormat(),columns)
+    for row in rows
+      write_row(io,CSVFormat(),row)
+    end
+  end
+  csvfile
+end
@@ -11,13 +11,42 @@ const SDL_WINDOWEVENT_FOCUS_GAINED = 0x0000000c
 const SDL_WINDOWEVENT_FOCUS_LOST = 0x0000000d
 
 const type_ptr = 0x0000000000000000       # offsetof(SDL_Event,type)
+const timestamp_ptr = 0x0000000000000004  # offsetof(SDL_CommonEvent,timestamp)
 const keysym_ptr = 0x0000000000000010     # offsetof(SDL_KeyboardEvent,keysym)
 const sym_ptr = 0x0000000000000004        # offsetof(SDL_Keysym,sym)
 const mod_ptr = 0x0000000000000008        # offsetof(SDL_Keysym,mod)
 const win_event_ptr = 0x000000000000000c  # offsetof(SDL_WindowEvent,event)
 const event_size = 0x0000000000000038     # sizeof(SDL_Event)
 
-function poll_events(callback,exp::ExtendedExperiment,time::Float64)
+const SDL_GETEVENT = 2
+const SDL_FIRSTEVENT = 0x00000000
+const SDL_LASTEVENT = 0x0000ffff
+
+# events are read from SDL in batches, into a buffer that is reused across
+# calls to `poll_events`
+const event_batch_size = 64
+const event_buffer = Array{UInt8}(event_size*event_batch_size)
+
+# SDL stamps each event with the time (in milliseconds, see SDL_GetTicks) at
+# which it was queued. Convert this stamp to an experiment time: the poll
+# happened at `time`, and `ticks` milliseconds since SDL was initialized.
+#
+# Note that SDL queues most input when the events are pumped, i.e. during the
+# poll, so that the stamp is usually the time of the poll: the precision of
+# event times is mostly determined by how often input is polled (see the
+# `input_resolution` of `Experiment`). The stamp improves on this for events
+# that were queued before the poll.
+function event_time(event::Ptr{Void},time::Float64,ticks::UInt32)
+  stamp = at(event,UInt32,timestamp_ptr)
+  # the subtraction wraps around, like the stamps themselves (every ~49 days).
+  # A stamp slightly ahead of `ticks` (read just before the event arrived)
+  # wraps to a huge difference: such an event is given the time of the poll.
+  elapsed = ticks - stamp
+  time - (elapsed > 0x80000000 ? 0x00000000 : elapsed)/1000
+end
+
+@inline function poll_events{F}(callback::F,exp::ExtendedExperiment,
+                                time::Float64)
   poll_events(callback,next(exp),time)
 end
 
@@ -26,7 +55,7 @@ end
 
 Call the function `callback`, possibility multiple times, passing it an event
 object each time. The time at which the events are polled is passed,
-allowing this time to be stored with the event.
+allowing the time at which each event occurred to be determined.
 
 !!! warning
 
@@ -35,29 +64,48 @@ allowing this time to be stored with the event.
     allowing it to report new kinds events.
 
 """
-function poll_events{T <: BaseExperiment{SDLWindow}}(callback,exp::T,time::Float64)
-  event_bytes = Array{Int8}(event_size)
-  event = reinterpret(Ptr{Void},pointer(event_bytes))
-
-  while ccall((:SDL_PollEvent,weber_SDL2),Cint,(Ptr{Void},),event) != 0
-    etype = at(event,UInt32,type_ptr)
-    if etype == SDL_KEYDOWN
-      code = at(event,UInt32,keysym_ptr + sym_ptr)
-      mod = at(event,UInt16,keysym_ptr + mod_ptr)
-      callback(exp,KeyDownEvent(code,mod,time))
-    elseif etype == SDL_KEYUP
-      code = at(event,UInt32,keysym_ptr + sym_ptr)
-      mod = at(event,UInt16,keysym_ptr + mod_ptr)
-      callback(exp,KeyUpEvent(code,mod,time))
-    elseif etype == SDL_WINDOWEVENT
-      wevent = at(event,UInt8,win_event_ptr)
-      if wevent == SDL_WINDOWEVENT_FOCUS_GAINED
-        callback(exp,WindowFocused(time))
-      elseif wevent == SDL_WINDOWEVENT_FOCUS_LOST
-        callback(exp,WindowUnfocused(time))
-      end
-    elseif etype == SDL_QUIT
-      callback(exp,QuitEvent())
+function poll_events{T <: BaseExperiment{SDLWindow},F}(callback::F,exp::T,
+                                                     time::Float64)
+  ccall((:SDL_PumpEvents,weber_SDL2),Void,())
+  ticks = ccall((:SDL_GetTicks,weber_SDL2),UInt32,())
+  buffer = Ptr{Void}(pointer(event_buffer))
+
+  while true
+    n = ccall((:SDL_PeepEvents,weber_SDL2),Cint,
+              (Ptr{Void},Cint,Cint,UInt32,UInt32),buffer,event_batch_size,
+              SDL_GETEVENT,SDL_FIRSTEVENT,SDL_LASTEVENT)
+    if n < 0
+      error("Failed to read input events: "*SDL_GetError())
+    end
+
+    for i in 0:(n-1)
+      event = buffer + i*event_size
+      handle_sdl_event(callback,exp,event,event_time(event,time,ticks))
+    end
+    n < event_batch_size && break
+  end
+end
+
+# decoding an event does not allocate: the callback is specialized on, and all
+# events are immutable bits types.
+function handle_sdl_event{F}(callback::F,exp,event::Ptr{Void},time::Float64)
+  etype = at(event,UInt32,type_ptr)
+  if etype == SDL_KEYDOWN
+    code = at(event,UInt32,keysym_ptr + sym_ptr)
+    mod = at(event,UInt16,keysym_ptr + mod_ptr)
+    callback(exp,KeyDownEvent(code,mod,time))
+  elseif etype == SDL_KEYUP
+    code = at(event,UInt32,keysym_ptr + sym_ptr)
+    mod = at(event,UInt16,keysym_ptr + mod_ptr)
+    callback(exp,KeyUpEvent(code,mod,time))
+  elseif etype == SDL_WINDOWEVENT
+    wevent = at(event,UInt8,win_event_ptr)
+    if wevent == SDL_WINDOWEVENT_FOCUS_GAINED
+      callback(exp,WindowFocused(time))
+    elseif wevent == SDL_WINDOWEVENT_FOCUS_LOST
+      callback(exp,WindowUnfocused(time))
     end
+  elseif etype == SDL_QUIT
+    callback(exp,QuitEvent())
   end
 end
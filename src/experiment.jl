@@ -1,43 +1,74 @@
 using Lazy: @>, takewhile
 import Base: run
-export Experiment, setup, run, addcolumn
+export Experiment, setup, run, addcolumn, critical
 
 const default_moment_resolution = 1.5ms
-const default_input_resolution = (1/60)s
+const default_input_resolution = 1ms
+const default_spin_window = 1ms
 const exp_width = 1024
 const exp_height = 768
 
+# The experiment being setup or run is tracked separately for each task, so
+# that several experiments can be run at once, each in its own task (e.g. using
+# `@async`). The experiment of the main task is stored in a global, so that
+# looking it up stays fast. Concurrent experiments still share the process's
+# sound device (see `setup_sound`), and garbage collection stays disabled while
+# any of them disables it (see `gc_policy`).
 const experiment_context = Array{Nullable{Experiment}}()
 experiment_context[] = Nullable()
+const main_task = Array{Task}()
+main_task[] = current_task()
+
+function current_context()
+  task = current_task()
+  if task === main_task[]
+    experiment_context[]
+  else
+    get(task_local_storage(),:weber_experiment,Nullable{Experiment}())
+  end
+end
+
+# sets the experiment of the current task, returning the previous one
+function set_context!(context::Nullable)
+  previous = current_context()
+  if current_task() === main_task[]
+    experiment_context[] = context
+  else
+    task_local_storage(:weber_experiment,context)
+  end
+  previous
+end
 
 # internal function, usd to find the current experiment
 function get_experiment()
-  if isnull(experiment_context[])
+  context = current_context()
+  if isnull(context)
     error("Unknown experiment context, call me inside `setup` or during an"*
           " experiment.")
   else
-    get(experiment_context[])
+    get(context)
   end
 end
 
 # internal function used to determine if there is an experiment running
 function in_experiment()
-  !isnull(experiment_context[])
+  !isnull(current_context())
 end
 
 function experiment_running()
-  !isnull(experiment_context[]) && flags(get(experiment_context[])).processing
+  context = current_context()
+  !isnull(context) && flags(get(context)).processing
 end
 
 # internal functions used to update and retrieve the stack trace
 # where the currently running moment was defined (improving error message
 # readability)
-const current_moment_trace = Array{Vector{StackFrame}}()
-update_trace(m::AbstractMoment) =
-  !isempty(moment_trace(m)) ? current_moment_trace[] = moment_trace(m) : nothing
-update_trace(m::MomentSequence) =
-  current_moment_trace[] = moment_trace(m.data[1])
-moment_trace() = current_moment_trace[]
+update_trace(exp,m::AbstractMoment) =
+  !isempty(moment_trace(m)) ? data(exp).trace = moment_trace(m) : nothing
+update_trace(exp,m::MomentSequence) = data(exp).trace = moment_trace(m.data[1])
+function moment_trace()
+  in_experiment() ? stack_trace(data(get_experiment()).trace) : StackFrame[]
+end
 function moment_trace_string()
   if in_experiment()
     "\nOn trial $(Weber.trial()), offset $(Weber.offset())"*
@@ -87,10 +118,58 @@ microsecond precision.
 """
 tick(exp) = data(exp).last_time
 function tick()
-  if isnull(experiment_context[])
+  context = current_context()
+  if isnull(context)
     precise_time()
   else
-    tick(get(experiment_context[]))
+    tick(get(context))
+  end
+end
+
+"""
+    Weber.wakeup_stats([experiment])
+
+Reports how accurately the experiment woke up from each sleep, relative to the
+requested wake-up time, when using `scheduler=:sleep` (see
+[`Experiment`](@ref)). Positive errors indicate the experiment woke up late.
+If the error is often larger than the `spin_window`, moments will be delivered
+late, and you should increase the `spin_window`.
+
+This can be called during, or after an experiment runs.
+"""
+wakeup_stats(exp) = data(exp).wakeup
+wakeup_stats() = wakeup_stats(get_experiment())
+
+"""
+    Weber.run_stats([experiment])
+
+Reports timing statistics about the run loop of an experiment, each stored in a
+histogram of fixed size. These include:
+
+* **latency** the latency of each kind of moment: the time between when it
+  should have been presented and when it was.
+* **loop** the time spent processing each iteration of the run loop,
+  excluding any time spent sleeping.
+* **sleep_overshoot** how much later than requested the run loop wakes up
+  from a sleep.
+* **stream_lateness** how long after it was due an audio stream was refilled.
+* **present** the time taken to present each new frame of the display.
+
+The percentiles of each histogram can be found using `quantile` (e.g.
+`quantile(Weber.run_stats().loop,0.99)`). This can be called during, or after
+an experiment runs. Once an experiment ends, these statistics are also
+written to a csv file, stored alongside the data file, and ending in
+"_timing.csv". Use these statistics to select an appropriate
+`moment_resolution` and `input_resolution` for a particular machine (see
+[`Experiment`](@ref)).
+"""
+run_stats(exp) = data(exp).stats
+run_stats() = run_stats(get_experiment())
+
+# the time taken to present a frame, see `show_drawn`
+function observe_present!(secs)
+  if in_experiment()
+    observe!(data(get_experiment()).stats.present,secs)
   end
 end
 
@@ -121,6 +200,7 @@ function addcolumn{T <: BaseExperiment}(exp::T,col::Symbol)
   end
   if col ∉ info(exp).header
     push!(info(exp).header,col)
+    info(exp).record_plan.compiled = false
   end
 end
 function addcolumn(exp::ExtendedExperiment,col::Symbol)
@@ -130,7 +210,11 @@ addcolumn(col::Symbol) = addcolumn(get_experiment(),col)
 
 """
     Experiment([skip=0],[columns=[symbols...]],[debug=false],
-               [moment_resolution=0.0015],[data_dir="data"],
+               [moment_resolution=0.0015],[data_dir="data"],[format=:csv],
+               [scheduler=:spin],[spin_window=0.001],[input_resolution],
+               [prepare_horizon=0s],
+               [observer],
+               [gc_policy=:auto],[gc_report=false],[moment_traces=:compact],
                [width=1024],[height=768],[warn_on_trials_only=true],[extensions=[]])
 
 Prepares a new experiment to be run.
@@ -149,8 +233,72 @@ Prepares a new experiment to be run.
 * **moment_resolution** the desired precision that moments
   should be presented at. Warnings will be printed for moments that
   lack this precision.
+* **scheduler** how the experiment waits for the next moment. With `:spin`
+  (the default) the experiment only sleeps when the next moment is far away,
+  and otherwise continuously checks the time, keeping one processor core
+  busy. With `:sleep` the experiment sleeps, using a high resolution
+  operating system timer, until `spin_window` seconds before the next
+  moment (or input poll, or audio stream update), and only checks the time
+  continuously during that last window. See [`Weber.wakeup_stats`](@ref) to
+  determine an appropriate window for your machine.
+  With `:virtual` the experiment doesn't wait at all: each moment is run as
+  soon as the previous one is done, in the order, and with the times, that it
+  would have occurred in a real experiment. This requires `null_window=true`,
+  and is used to simulate experiments (see [`simulate`](@ref)).
+* **input_resolution** how often input events (e.g. key presses) are checked
+  for. Each event is given the time at which it was found, so this determines
+  the precision of response times. By default, input is checked every
+  millisecond, or, with the `:sleep` scheduler, every `spin_window` plus a
+  millisecond (so the experiment can sleep in between).
+* **spin_window** the duration before a moment during which the `:sleep`
+  scheduler continuously checks the time. This should be less than
+  `moment_resolution`.
+* **prepare_horizon** how far ahead of time moments are prepared. By default
+  the sound of a moment such as `moment(play,() -> tone(1kHz,0.1s))` is only
+  generated once the last pause before it has begun (see
+  [`Weber.prepare!`](@ref)). With a non-zero horizon (e.g. `500ms`), the sounds
+  and visuals of moments created from functions are generated during the
+  idle time of the experiment, up to this long before they are due, which
+  makes it possible to present rapid sequences of generated stimuli. The
+  functions passed to these moments are then called earlier than they
+  otherwise would be, so they should not depend on what happens in the
+  moments just before them.
+* **observer** the simulated participant for an experiment using the
+  `:virtual` scheduler. This function is called as `observer(experiment,time)`
+  after the moments due at each point in time have run. It can return
+  `nothing`, an event
+  or an iterable of events, which occur at or after `time`. For example, a key
+  press of "p" 300ms from now can be simulated by returning
+  `Weber.KeyDownEvent(key"p",time + 0.3)`.
+* **gc_policy** when garbage is collected. With `:auto` (the default) Julia
+  collects garbage whenever it needs to, and the experiment also collects
+  garbage when the next moment is more than a second away. With `:boundaries`
+  automatic collection is disabled while the experiment runs, and garbage is
+  only collected during the first idle time after the start of each trial,
+  practice or break (and while paused). Under either policy, garbage is never
+  collected during the moments marked by [`critical`](@ref). When several
+  experiments run at once, collection stays disabled while any of them
+  disables it.
+* **gc_report** when true, a row with the code "memory" is recorded at the
+  start of each trial, practice and break, reporting the bytes allocated
+  (`alloc_bytes`) and the seconds spent collecting garbage (`gc_time`) since
+  the previous one. Each collection run by the experiment is recorded as a row
+  with the code "gc", with its duration in seconds as the `gc_time`.
+* **moment_traces** how Weber keeps track of where each moment was created,
+  which is reported in error messages and latency warnings.
+  With `:compact` (the default) a moment stores a small reference
+  to where it was created, and the location is looked up the first time it is
+  reported. With `:full` the location of each new place moments are created is
+  looked up immediately, so that reporting a location during the experiment
+  is fast. With `:none` locations are not tracked, which makes creating very
+  many moments faster.
 * **data_dir** the directory where data files should be stored (can be set to
   nothing to prevent a file from being created)
+* **format** the format of the data file. Either `:csv` (the default) or
+  `:binary`. A binary file (with a .wlog extension) stores each value with its
+  type, so that numbers are stored without loss of precision, and recording
+  a row is faster. Binary files can be read using [`read_binary_data`](@ref) or
+  converted to a csv file using [`binary_to_csv`](@ref).
 * **width** and **height** specified the screen resolution during the experiment
 * **extensions** an array of Weber.Extension objects, which [extend](extend.md)
   the behavior of an experiment.
@@ -161,18 +309,25 @@ Prepares a new experiment to be run.
 """
 function Experiment(;skip=0,columns=Symbol[],debug=false,
                     moment_resolution = default_moment_resolution,
+                    scheduler = :spin,
+                    spin_window = default_spin_window,
+                    prepare_horizon = 0s,
+                    observer = no_observer,
+                    gc_policy = :auto,
+                    gc_report = false,
+                    moment_traces = :compact,
                     data_dir = "data",
+                    format = :csv,
                     null_window = false,
                     hide_output = false,
-                    input_resolution = default_input_resolution,
+                    input_resolution = nothing,
                     extensions = Extension[],
                     width=exp_width,height=exp_height,
                     warn_on_trials_only = true)
   if !sound_is_setup() && !null_window
     setup_sound()
     clear_sound_cache()
-    empty!(_image_cache)
-    empty!(convert_cache)
+    clear_image_cache()
   end
   TimedSound.sound_setup_state.hooks = WeberSoundHooks()
   TimedSound.sound_setup_state.cache = true
@@ -187,7 +342,32 @@ function Experiment(;skip=0,columns=Symbol[],debug=false,
   end
 
   moment_resolution_s = ustrip(inseconds(moment_resolution))
-  input_resolution_s = ustrip(inseconds(input_resolution))
+  spin_window_s = ustrip(inseconds(spin_window))
+  input_resolution_s = if input_resolution == nothing
+    default_s = ustrip(inseconds(default_input_resolution))
+    scheduler == :sleep ? spin_window_s + default_s : default_s
+  else
+    ustrip(inseconds(input_resolution))
+  end
+  prepare_horizon_s = ustrip(inseconds(prepare_horizon))
+  if scheduler ∉ [:spin,:sleep,:virtual]
+    error("Unknown scheduler `$scheduler`, expected :spin, :sleep or :virtual.")
+  end
+  if scheduler == :virtual && !null_window
+    error("The :virtual scheduler requires `null_window=true`.")
+  end
+  if moment_traces ∉ [:compact,:full,:none]
+    error("Unknown moment_traces `$moment_traces`, expected :compact, :full ",
+          "or :none.")
+  end
+  if gc_policy ∉ [:auto,:boundaries]
+    error("Unknown gc_policy `$gc_policy`, expected :auto or :boundaries.")
+  end
+  if scheduler == :sleep && spin_window_s >= moment_resolution_s
+    warn("The `spin_window` ($spin_window) should be less than the ",
+         "`moment_resolution` ($moment_resolution), otherwise the experiment ",
+         "will not sleep until the moment is due.")
+  end
   if moment_resolution_s < approx_timer_resolution
     warn("The desired timing resolution of $moment_resolution "*
                   "seconds is probably not achievable on your system. The "*
@@ -203,11 +383,16 @@ function Experiment(;skip=0,columns=Symbol[],debug=false,
   info_values = filter(x -> x isa Pair,columns)
   reserved_columns = filter(x -> !(x isa Pair),columns)
   info_str = join(map(x -> x[2],info_values),"_")
-  filename = (data_dir == nothing || hide_output ? Nullable() :
-              Nullable(joinpath(data_dir,info_str*"_"*timestr*".csv")))
+  data_fmt = data_format(format)
+  filename = (data_dir == nothing || hide_output ? Nullable{String}() :
+              Nullable(joinpath(data_dir,info_str*"_"*timestr*
+                                file_extension(data_fmt))))
   einfo = ExperimentInfo(info_values,meta,input_resolution_s,
-                         moment_resolution_s,start_date,reserved_columns,
-                         filename,hide_output,warn_on_trials_only)
+                         moment_resolution_s,scheduler,spin_window_s,
+                         prepare_horizon_s,observer,moment_traces,start_date,
+                         reserved_columns,filename,RecordPlan(),
+                         RecordBuffer(filename,data_fmt),
+                         hide_output,warn_on_trials_only)
 
   offset = 0
   trial = 0
@@ -215,13 +400,16 @@ function Experiment(;skip=0,columns=Symbol[],debug=false,
   last_time = 0.0
   next_moment = 0.0
   pause_mode = Running
-  moments = [MomentQueue()]
+  moments = MomentQueues(MomentQueue())
   streamers = Dict{Int,TimedSound.Streamer}()
   last_good_delta = -1.0
   last_bad_delta = -1.0
   data = ExperimentData(offset,trial,skip,last_time,next_moment,trial_watcher,
-                        pause_mode,moments,streamers,last_good_delta,
-                        last_bad_delta)
+                        pause_mode,moments,streamers,
+                        Dict{Int,SoundStream}(),last_good_delta,
+                        last_bad_delta,WakeupStats(),
+                        GCState(gc_policy,gc_report),RunStats(),no_trace,
+                        Stack(ExpandingMoment),Function[])
 
   running = processing = false
   flags = ExperimentFlags(running,processing)
@@ -230,37 +418,58 @@ function Experiment(;skip=0,columns=Symbol[],debug=false,
 
   final_exp = extend(UnextendedExperiment(einfo,data,flags,win),extensions)
   addcolumn(final_exp,:value)
+  if gc_report
+    addcolumn(final_exp,:alloc_bytes)
+    addcolumn(final_exp,:gc_time)
+  end
   final_exp
 end
 
 
 """
-    setup(fn,experiment)
+    setup(fn,experiment;[precompile_moments=true])
 
 Setup the experiment, adding breaks, practice, and trials.
 
 Setup creates the context necessary to generate elements of an experiment. All
 calls to `addtrial`, `addbreak` and `addpractice` must be called inside of
 `fn`. This function must be called before `run`.
+
+Once all trials have been added, the code needed to present each kind of moment
+(including the functions passed to [`moment`](@ref)) is compiled, so that this
+does not have to happen during the experiment. For experiments with very many
+distinct moments you can skip this step by passing `precompile_moments=false`.
 """
-setup(fn::Function,exp::ExtendedExperiment) = setup(fn,next(exp))
-function setup{T <: BaseExperiment}(fn::Function,exp::T)
+function setup(fn::Function,exp::ExtendedExperiment;keys...)
+  setup(fn,next(exp);keys...)
+end
+function setup{T <: BaseExperiment}(fn::Function,exp::T;precompile_moments=true)
+  previous = set_context!(Nullable(top(exp)))
   try
     # setup all trial moments for this experiment
-    experiment_context[] = Nullable(top(exp))
     addmoment(top(exp),moment())
     fn()
-    experiment_context[] = Nullable{Experiment}()
+    precompile_moments && Weber.precompile_moments(exp)
   catch e
+    empty!(data(exp).deferred)
     close(win(exp))
-    # gc_enable(true)
+    release_gc!(exp)
     rethrow(e)
+  finally
+    set_context!(previous)
   end
   nothing
 end
 
+# true once the methods used by a typical experiment have been compiled: either
+# by a previous warmup run, or by building a system image that includes Weber
+# (see deps/build_sysimg.jl)
+const warmed_up = Array{Bool}()
+warmed_up[] = false
+
 warmup_run(exp::Experiment{NullWindow}) = nothing
 function warmup_run(exp::Experiment)
+  warmed_up[] && return
   # warm up JIT compilation
   warm_up = Experiment(null_window=true,hide_output=true)
   setup(warm_up) do
@@ -278,6 +487,7 @@ function warmup_run(exp::Experiment)
     end
   end
   run(warm_up,await_input=false)
+  warmed_up[] = true
 end
 
 
@@ -287,6 +497,7 @@ function pause(exp,message,time,firstpause=true)
   if firstpause
     save_display(win(exp))
     pause_sounds()
+    pause_streams!(exp,time)
   end
   overlay = visual(colorant"gray",priority=Inf) + visual(message,priority=Inf)
   display(win(exp),overlay)
@@ -298,6 +509,7 @@ function unpause(exp,time)
 
   restore_display(win(exp))
   resume_sounds()
+  resume_streams!(exp,time)
 
   data(exp).last_bad_delta = -1.0
   data(exp).last_good_delta = -1.0
@@ -381,18 +593,23 @@ function run{T <: BaseExperiment}(
   warmup_run(exp)
   # println("========================================")
   # println("Completed warmup run.")
+  previous = current_context()
   try
     record_header(exp)
     focus(win(exp))
 
-    experiment_context[] = Nullable(top(exp))
+    set_context!(Nullable(top(exp)))
     data(exp).pause_mode = Running
     flags(exp).processing = true
     flags(exp).running = true
 
     start = precise_time()
     tick = data(exp).last_time = last_input = last_delta = 0.0
+    seek_offset!(exp,data(exp).moments)
     prepare!(data(exp).moments[1],Inf)
+    init_deadlines!(exp,data(exp).moments)
+    start_gc!(exp)
+    info(exp).scheduler == :virtual && run_virtual(exp)
     while flags(exp).processing && !isempty(data(exp).moments)
       tick = data(exp).last_time = precise_time() - start
 
@@ -411,10 +628,12 @@ function run{T <: BaseExperiment}(
       next_stream = Inf
       for streamer in values(data(exp).streamers)
         if tick > streamer.next_stream
+          observe!(data(exp).stats.stream,tick - streamer.next_stream)
           process(streamer)
           next_stream = min(next_stream,streamer.next_stream)
         end
       end
+      next_stream = min(next_stream,update_streams!(exp,tick))
 
       # # report on any irregularity in the timing of moments
       # if flags(exp).running && tick - last_delta > last_delta_resolution
@@ -428,18 +647,34 @@ function run{T <: BaseExperiment}(
       # if after all this processing there's still plenty of time left
       # then sleep for a little while. (pausing also sleeps the loop)
       new_tick = precise_time() - start
+      observe!(data(exp).stats.loop,new_tick - tick)
       stream_len = ustrip(TimedSound.sound_setup_state.stream_unit/samplerate())
       if !flags(exp).running
-        gc()
+        flush_records!(info(exp).records)
+        run_deferred(exp,start + new_tick + sleep_amount)
+        fill_streams!(exp,start + new_tick + sleep_amount)
+        collect_garbage(exp,Inf)
         sleep(sleep_amount)
+      elseif info(exp).scheduler == :sleep
+        deadline = min(data(exp).next_moment,
+                       last_input + info(exp).input_resolution,
+                       next_stream_time(exp) - 0.2stream_len,
+                       next_display_change(win(exp)))
+        sleep_until(exp,deadline - info(exp).spin_window,start,new_tick)
       elseif ((new_tick - last_delta) > sleep_resolution &&
               (new_tick - last_input) > sleep_resolution &&
               new_tick + 0.2stream_len < next_stream &&
               (data(exp).next_moment - new_tick) > sleep_resolution)
-        if (data(exp).next_moment - new_tick) > gc_time
-          gc()
-        end
-        sleep(min(sleep_amount,0.05stream_len))
+        flush_records!(info(exp).records)
+        run_deferred(exp,start + data(exp).next_moment - sleep_resolution)
+        prepare_ahead!(exp,new_tick,start + data(exp).next_moment -
+                       sleep_resolution)
+        fill_streams!(exp,start + data(exp).next_moment - sleep_resolution)
+        collect_garbage(exp,data(exp).next_moment - new_tick)
+        requested = min(sleep_amount,0.05stream_len)
+        slept = precise_time()
+        sleep(requested)
+        observe!(data(exp).stats.sleep,precise_time() - slept - requested)
       end
     end
   catch e
@@ -454,11 +689,14 @@ function run{T <: BaseExperiment}(
     end
   finally
     record(top(exp),"closed")
+    close_records!(info(exp).records)
+    write_stats(exp)
     flags(exp).running = false
     flags(exp).processing = false
-    experiment_context[] = Nullable()
+    set_context!(previous)
+    empty!(data(exp).deferred)
     close(win(exp))
-    # gc_enable(true)
+    release_gc!(exp)
     if !info(exp).hide_output
       info("Experiment terminated at offset $(data(exp).offset).")
       if !isnull(info(exp).file)
@@ -473,17 +711,314 @@ function run{T <: BaseExperiment}(
   nothing
 end
 
+no_observer(exp,time) = nothing
+
+# the run loop of the `:virtual` scheduler: the clock jumps straight to the
+# next moment or simulated event.
+function run_virtual(exp)
+  events = ExpEvent[]
+  tick = 0.0
+  while flags(exp).processing && !isempty(data(exp).moments)
+    data(exp).last_time = tick
+    process(exp,data(exp).moments,tick)
+    add_events!(events,info(exp).observer(top(exp),tick))
+    while !isempty(events) && time(events[1]) <= tick
+      process_event(top(exp),shift!(events))
+    end
+    run_deferred(exp,Inf)
+
+    next_event = isempty(events) ? Inf : time(events[1])
+    tick = max(tick,min(data(exp).next_moment,next_event))
+    if isinf(tick) && !isempty(data(exp).moments)
+      error("The simulated experiment is waiting for an event, but the ",
+            "observer didn't provide one.")
+    end
+    data(exp).last_time = tick
+  end
+end
+
+add_events!(events,::Void) = events
+function add_events!(events,event::ExpEvent)
+  insert!(events,searchsortedlast(events,event,by=time)+1,event)
+end
+add_events!(events,xs) = (foreach(x -> add_events!(events,x),xs); events)
+
+# work that can happen at any point while an experiment runs (such as
+# preparing visuals, see `prefetch`) is deferred to the idle time of the run
+# loop. Each job is a function, called repeatedly until it returns true, that
+# does a small piece of work each time it is called. Each experiment has its
+# own jobs, which are dropped once it stops running, so that a job (and the
+# window it may refer to) never runs as part of another experiment.
+defer(job::Function) = defer(get_experiment(),job)
+defer(exp::Experiment,job::Function) = (push!(data(exp).deferred,job); nothing)
+
+# run deferred jobs until the given time (as measured by `precise_time`)
+function run_deferred(exp,until)
+  jobs = data(exp).deferred
+  while !isempty(jobs) && precise_time() < until
+    if jobs[1]()
+      shift!(jobs)
+    end
+  end
+end
+
+# prepare the moments due within the experiment's `prepare_horizon`, until the
+# given time (as measured by `precise_time`). Each queue is walked from its
+# front, accumulating the onset of each moment, and stopping at the first
+# moment whose onset cannot be known ahead of time.
+function prepare_ahead!(exp,tick,until)
+  horizon = info(exp).prepare_horizon
+  horizon > 0.0 || return
+  for queue in data(exp).moments
+    onset = queue.last
+    for moment in queue
+      precise_time() < until || return
+      (moment isa AbstractTimedMoment &&
+       !isinf(required_delta_t(moment))) || break
+      onset += delta_t(moment)
+      onset - tick > horizon && break
+      prepare_early!(moment)
+    end
+  end
+end
+
+################################################################################
+# garbage collection
+
+# Collection is disabled for as long as any experiment needs it to be. The
+# number of experiments that disable collection, and the number that are in a
+# critical region, are shared by all experiments, so that one experiment never
+# re-enables collection while another relies on it being disabled.
+const gc_disabling = Array{Int}()
+gc_disabling[] = 0
+const gc_critical = Array{Int}()
+gc_critical[] = 0
+
+function disable_gc!(state::GCState,disable::Bool)
+  if disable != state.disabled
+    state.disabled = disable
+    gc_disabling[] += disable ? 1 : -1
+  end
+  gc_enable(gc_disabling[] == 0)
+end
+
+function start_gc!(exp)
+  state = data(exp).gc
+  state.bytes,state.time_ns = Base.gc_bytes(),Base.gc_time_ns()
+  disable_gc!(state,state.policy != :auto || state.critical > 0)
+end
+
+# called once an experiment stops (or fails to setup)
+function release_gc!(exp)
+  state = data(exp).gc
+  state.critical > 0 && (gc_critical[] -= 1)
+  state.critical = 0
+  disable_gc!(state,false)
+end
+
+# collect garbage, if the experiment's policy allows it, when the run loop is
+# idle for the given number of seconds
+function collect_garbage(exp,idle)
+  state = data(exp).gc
+  state.critical > 0 && return
+  if state.policy == :auto
+    idle > gc_time && timed_gc(exp)
+  elseif state.requested && gc_critical[] == 0
+    state.requested = false
+    gc_enable(true)
+    timed_gc(exp)
+    gc_enable(gc_disabling[] == 0)
+  end
+end
+
+function timed_gc(exp)
+  state = data(exp).gc
+  if state.report
+    started = Base.gc_time_ns()
+    gc()
+    record(top(exp),"gc",gc_time=(Base.gc_time_ns() - started)/1e9)
+  else
+    gc()
+  end
+end
+
+# called at the start of each trial, practice and break
+function trial_boundary(exp)
+  state = data(exp).gc
+  state.requested = true
+  if state.report
+    bytes,time_ns = Base.gc_bytes(),Base.gc_time_ns()
+    record(exp,"memory",alloc_bytes=bytes - state.bytes,
+           gc_time=(time_ns - state.time_ns)/1e9)
+    state.bytes,state.time_ns = bytes,time_ns
+  end
+end
+
+"""
+    critical(moments...)
+
+Marks the given moments as a critical region: garbage is never collected
+while these moments are presented, regardless of the experiment's `gc_policy`
+(see [`Experiment`](@ref)). Use this for sequences of moments that require
+precise timing, for example:
+
+    addtrial(critical(moment(play,tone1),moment(0.1s,play,tone2)),
+             moment(response))
+
+Memory continues to be allocated in a critical region, so these regions
+should be kept short.
+"""
+critical(moments...) =
+  [moment(() -> start_critical(get_experiment())),moments...,
+   moment(() -> end_critical(get_experiment()))]
+
+function start_critical(exp)
+  state = data(exp).gc
+  state.critical += 1
+  state.critical == 1 && (gc_critical[] += 1)
+  disable_gc!(state,true)
+  nothing
+end
+
+function end_critical(exp)
+  state = data(exp).gc
+  state.critical > 0 || return
+  state.critical -= 1
+  if state.critical == 0
+    gc_critical[] -= 1
+    disable_gc!(state,state.policy != :auto)
+  end
+  nothing
+end
+
+function next_stream_time(exp)
+  next_stream = Inf
+  for streamer in values(data(exp).streamers)
+    next_stream = min(next_stream,streamer.next_stream)
+  end
+  for s in values(data(exp).sound_streams)
+    next_stream = min(next_stream,next_chunk_time(s))
+  end
+  next_stream
+end
+
+# used by the `:sleep` scheduler to wait until the next deadline
+function sleep_until(exp,wake,start,tick)
+  if wake - tick > sleep_resolution
+    # there's plenty of time, so do any other work first
+    flush_records!(info(exp).records)
+    run_deferred(exp,start + wake - sleep_resolution)
+    prepare_ahead!(exp,tick,start + wake - sleep_resolution)
+    fill_streams!(exp,start + wake - sleep_resolution)
+    collect_garbage(exp,wake - tick)
+    tick = precise_time() - start
+  end
+
+  if wake > tick
+    precise_sleep(wake - tick)
+    woke = precise_time() - start
+    record_wakeup!(data(exp).wakeup,woke - wake,info(exp).spin_window)
+    observe!(data(exp).stats.sleep,woke - wake)
+    yield()
+  end
+end
+
+function write_stats(exp)
+  if !isnull(info(exp).file)
+    open(splitext(get(info(exp).file))[1]*"_timing.csv","w") do io
+      write_stats(io,data(exp).stats)
+    end
+  end
+end
+
 function endexperiment(e::Experiment)
   flags(e).running = false
   flags(e).processing = false
 end
 
-function process(exp::Experiment,queues::Array{MomentQueue},x)
-  filter!(queues) do queue
-    !isempty(process(exp,queue,x))
+function init_deadlines!(exp::Experiment,queues::MomentQueues)
+  for queue in queues
+    update_deadline!(exp,queues,queue)
+  end
+  remove_empty!(exp,queues)
+end
+
+function update_deadline!(exp::Experiment,queues::MomentQueues,
+                          queue::MomentQueue)
+  skip_offsets(exp,queue)
+  if isempty(queue)
+    queue.heap_index > 0 && remove_deadline!(queues,queue)
+  else
+    update_deadline!(queues,queue,next_moment_time(queue))
   end
 end
 
+function remove_empty!(exp::Experiment,queues::MomentQueues)
+  if length(queues.heap) < length(queues.queues)
+    n = 0
+    for queue in queues.queues
+      if queue.heap_index > 0
+        queues.queues[n += 1] = queue
+      else
+        recycle!(queues,queue)
+      end
+    end
+    resize!(queues.queues,n)
+  end
+  data(exp).next_moment = next_deadline(queues)
+  queues
+end
+
+# all queues are notified of events
+function process(exp::Experiment,queues::MomentQueues,event::ExpEvent)
+  for i in 1:length(queues.queues)
+    queue = queues.queues[i]
+    process(exp,queue,event)
+    update_deadline!(exp,queues,queue)
+  end
+  remove_empty!(exp,queues)
+end
+
+# only those queues which are due are notified of the current time, each at
+# most once, in the order of their deadlines.
+function process(exp::Experiment,queues::MomentQueues,t::Float64)
+  due = queues.due
+  while !isempty(queues.heap) &&
+        next_deadline(queues) - t <= info(exp).moment_resolution
+    push!(due,pop_deadline!(queues))
+  end
+
+  for queue in due
+    process(exp,queue,t)
+    update_deadline!(exp,queues,queue)
+  end
+  empty!(due)
+
+  remove_empty!(exp,queues)
+end
+
+
+# drop all moments of the root queue which occur before the first offset that
+# isn't skipped, without inspecting them.
+function seek_offset!(exp::Experiment,queues::MomentQueues)
+  index = queues.offsets
+  skip = data(exp).skip_offsets
+  n = length(index.positions)
+  if skip > 1
+    queue = first(queues)
+    if skip <= n
+      drop!(queue,index.positions[skip]-1)
+      data(exp).offset = skip-1
+      data(exp).trial = index.trials[skip]
+    else
+      # the first unskipped offset is either created by a trial source, or
+      # lies past the end of the experiment
+      drop!(queue,index.stop > 0 ? index.stop-1 : length(queue))
+      data(exp).offset = n
+      data(exp).trial = index.n_trials
+    end
+  end
+end
 
 function skip_offsets(exp,queue)
   while !isempty(queue) && is_moment_skipped(exp,front(queue))
@@ -509,11 +1044,10 @@ function process(exp::Experiment,queue::MomentQueue,event::ExpEvent)
 
   if !isempty(queue)
     moment = front(queue)
-    update_trace(moment)
+    update_trace(exp,moment)
     handled = handle(exp,queue,moment,event)
     if handled
       prepare!(queue,time(event))
-      data(exp).next_moment = minimum(map(next_moment_time,data(exp).moments))
     end
   end
 
@@ -531,15 +1065,19 @@ function process(exp::Experiment,queue::MomentQueue,t::Float64)
     if event_time - t <= info(exp).moment_resolution
       offset = t - start_time
       run_time = offset + precise_time()
+      if info(exp).scheduler == :virtual
+        run_time = max(t,event_time)
+      end
       while event_time > run_time
         run_time = offset + precise_time()
       end
       data(exp).last_time = run_time
-      update_trace(moment)
+      update_trace(exp,moment)
       if handle(exp,queue,moment,run_time)
         prepare!(queue,run_time)
 
         latency = run_time - event_time
+        observe_moment!(data(exp).stats,moment,latency)
 
         if (latency > info(exp).moment_resolution &&
             warn_delta_t(moment) &&
@@ -555,8 +1093,6 @@ function process(exp::Experiment,queue::MomentQueue,t::Float64)
              `Experiment`.\nMoment: $moment \n\n"*moment_trace_string())
           record("high_latency",value=latency)
         end
-
-        data(exp).next_moment = minimum(map(next_moment_time,data(exp).moments))
       end
     end
   end
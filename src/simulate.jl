@@ -0,0 +1,47 @@
+export simulate, simulate_sessions
+
+"""
+    simulate(setup_fn;observer,[seed],keys...)
+
+Simulate a single session of an experiment: `setup_fn` is passed to
+[`setup`](@ref), and the experiment is run using the `:virtual` scheduler, so
+that it runs as fast as possible, without any window or sound (see
+[`Experiment`](@ref)). The `observer` simulates the participant's responses.
+Any other keyword arguments are passed to `Experiment`. If a `seed` is given,
+the random number generator is seeded with it before setup.
+
+Returns the rows recorded during the session, each row a dictionary from
+column names to values.
+"""
+function simulate(fn::Function;observer=no_observer,seed=nothing,keys...)
+  seed == nothing || srand(seed)
+  exp = Experiment(;null_window=true,hide_output=true,data_dir=nothing,
+                   scheduler=:virtual,observer=observer,keys...)
+  setup(fn,exp)
+  run(exp,await_input=false)
+  win(exp).records
+end
+
+"""
+    simulate_sessions(setup_fn,n;[parallel=nworkers() > 1],keys...)
+
+Simulate `n` sessions of an experiment (see [`simulate`](@ref)). The
+function `setup_fn` is called with the index of each session, and sets up
+the trials of that session. Returns the rows recorded by each session.
+
+When `parallel` is true the sessions are run across all worker processes
+(see `addprocs`), each of which runs its own experiments. In this case,
+`setup_fn`, and all the functions it uses, must be defined on every worker
+(e.g. using `@everywhere`). Session `i` is seeded with `i`, so the results
+are the same regardless of how the sessions are distributed.
+
+    @everywhere using Weber
+    @everywhere function my_session(i)
+      ...
+    end
+    results = simulate_sessions(my_session,1000,observer=my_observer)
+"""
+function simulate_sessions(fn::Function,n;parallel=nworkers() > 1,keys...)
+  session(i) = simulate(() -> fn(i);seed=i,keys...)
+  parallel ? pmap(session,1:n) : map(session,1:n)
+end
@@ -27,6 +27,13 @@ function TimedSound.on_high_latency(::WeberSoundHooks,latency)
   record("high_latency",value=latency)
 end
 
+# called when a stream (see `stream`) runs out of sound before its next chunk
+# is ready, leaving a gap of the given number of seconds.
+function on_stream_underrun(::WeberSoundHooks,channel,gap)
+  record("stream_underrun",value=gap)
+end
+on_stream_underrun(hooks,channel,gap) = nothing
+
 function TimedSound.on_no_timing(::WeberSoundHooks)
   warn("Cannot guarantee the timing of a sound. Add a delay before playing the",
        " sound if precise timing is required.",moment_trace_string())
@@ -0,0 +1,168 @@
+export stream, stop_stream
+
+# A stream is generated in small chunks, from an iterator, during the idle time
+# of the run loop, and stored in a fixed size ring buffer. Each time the run
+# loop is processed, the chunks due within the next `lead` seconds are taken
+# from the buffer and passed to TimedSound, along with their absolute onset,
+# so that they play back to back.
+
+const default_stream_lead = 500ms
+const default_stream_buffer = 16
+
+"""
+    stream(itr;[channel=1],[lead=500ms],[buffer=16])
+
+Play the sounds generated by the iterator `itr`, one after the other. This
+must be called during a moment (e.g. `moment(stream,itr)`, see
+[`moment`](@ref)). Each element of `itr` can be anything that can be passed to
+[`play`](@ref), and is played immediately after the previous one ends. The
+stream ends when the iterator does, so infinite iterators can be used to
+play a sound until [`stop_stream`](@ref) is called. For example, the following
+plays noise until the end of the trial, at a level that can be changed at
+any point by setting `level[]`.
+
+    level = Ref(20)
+    noise_chunks = (attenuate(noise(50ms),level[]) for _ in countfrom())
+    addtrial(moment(stream,noise_chunks),...,moment(stop_stream))
+
+Stream elements are generated ahead of time, while the experiment is idle, and
+up to `buffer` elements are kept ready. Each element is scheduled to play
+`lead` seconds before it is due, and so a change to the iterator's state
+(like `level` above) changes the sound after `lead` seconds. If the elements
+cannot be generated quickly enough, there will be a gap in the sound. Each
+gap is recorded as a "stream_underrun" row, with the duration of the gap as
+its value.
+
+The `channel` identifies the stream: starting a new stream on the same
+channel stops the old stream.
+"""
+function stream(itr;channel=1,lead=default_stream_lead,
+                buffer=default_stream_buffer)
+  if !experiment_running()
+    error("Cannot stream sounds during setup. Stream a sound within a moment ",
+          "(e.g. moment(stream,itr)).")
+  end
+  s = fill_stream!(SoundStream(itr,ustrip(inseconds(lead)),buffer))
+  start_stream!(get_experiment(),channel,s,tick())
+end
+
+"""
+    stop_stream([channel=1])
+
+Stop the stream that was started on the given channel (see
+[`stream`](@ref)). Sounds of the stream which have already been scheduled
+(those due within the stream's `lead`) still play.
+"""
+function stop_stream(channel=1)
+  delete!(data(get_experiment()).sound_streams,channel)
+  nothing
+end
+
+function push_chunk!(s::SoundStream,x)
+  s.buffer[mod1(s.first + s.count,length(s.buffer))] = x
+  s.count += 1
+  s
+end
+
+function shift_chunk!(s::SoundStream)
+  x = s.buffer[s.first]
+  s.first = mod1(s.first + 1,length(s.buffer))
+  s.count -= 1
+  x
+end
+
+# generate the next chunk of the stream, returning false if there are no more
+# chunks
+function fill_chunk!(s::SoundStream)
+  if s.finished || done(s.itr,s.state)
+    s.finished = true
+    false
+  else
+    x,s.state = next(s.itr,s.state)
+    push_chunk!(s,playable(x))
+    true
+  end
+end
+
+# fill the buffer of the stream, until the given time (as measured by
+# `precise_time`)
+function fill_stream!(s::SoundStream,until=Inf)
+  while s.count < length(s.buffer) && precise_time() < until
+    fill_chunk!(s) || break
+  end
+  s
+end
+
+function fill_streams!(exp,until)
+  for s in values(data(exp).sound_streams)
+    fill_stream!(s,until)
+  end
+end
+
+next_chunk_time(s::SoundStream) = s.next_onset - s.lead
+finished(s::SoundStream) = s.finished && s.count == 0
+
+function start_stream!(exp,channel,s::SoundStream,onset)
+  s.next_onset = onset
+  data(exp).sound_streams[channel] = s
+  schedule_stream!(channel,s,tick(exp))
+  nothing
+end
+
+# hand all chunks due within the stream's lead to TimedSound
+function schedule_stream!(channel,s::SoundStream,tick)
+  while s.next_onset - tick < s.lead
+    # if the run loop never had time to generate the next chunk, it has to
+    # happen now
+    s.count > 0 || fill_chunk!(s) || break
+    if s.scheduled > 0 && s.next_onset < tick
+      s.underruns += 1
+      on_stream_underrun(TimedSound.sound_setup_state.hooks,channel,
+                         tick - s.next_onset)
+      s.next_onset = tick
+    end
+
+    chunk = shift_chunk!(s)
+    TimedSound.play_(chunk,s.next_onset,0)
+    s.next_onset += ustrip(inseconds(duration(chunk)))
+    s.scheduled += 1
+  end
+  s
+end
+
+# called during each iteration of the run loop: returns the time at which the
+# next stream must be updated
+function update_streams!(exp,tick)
+  next_update = Inf
+  flags(exp).running || return next_update
+
+  streams = data(exp).sound_streams
+  any_finished = false
+  for (channel,s) in streams
+    if tick > next_chunk_time(s)
+      observe!(data(exp).stats.stream,tick - next_chunk_time(s))
+      schedule_stream!(channel,s,tick)
+      any_finished |= finished(s)
+    end
+    next_update = min(next_update,next_chunk_time(s))
+  end
+  any_finished && filter!((channel,s) -> !finished(s),streams)
+
+  next_update
+end
+
+# chunks that have already been scheduled are paused along with all other
+# sounds, so the onset of the next chunk must be delayed by the length of
+# the pause
+function pause_streams!(exp,time)
+  foreach(s -> s.paused = time,values(data(exp).sound_streams))
+end
+
+function resume_streams!(exp,time)
+  for s in values(data(exp).sound_streams)
+    if !isnan(s.paused)
+      s.next_onset += time - s.paused
+      s.paused = NaN
+    end
+  end
+end
@@ -28,3 +28,235 @@ end
 else
   const precise_time = time
 end
+
+"""
+    Weber.precise_sleep(seconds)
+
+Block for the given number of seconds, using a high resolution operating
+system timer. In contrast to `sleep`, this does not yield to other tasks, but
+it usually wakes up within tens of microseconds of the requested time.
+"""
+function precise_sleep end
+
+@static if is_windows()
+  const CREATE_WAITABLE_TIMER_HIGH_RESOLUTION = 0x00000002
+  const TIMER_ALL_ACCESS = 0x001f0003
+  const INFINITE = 0xffffffff
+  const waitable_timer = Array{Ptr{Void}}()
+  waitable_timer[] = C_NULL
+
+  function create_waitable_timer(flags)
+    ccall((:CreateWaitableTimerExW,"kernel32"),stdcall,Ptr{Void},
+          (Ptr{Void},Ptr{UInt16},UInt32,UInt32),
+          C_NULL,C_NULL,flags,TIMER_ALL_ACCESS)
+  end
+
+  function get_waitable_timer()
+    if waitable_timer[] == C_NULL
+      timer = create_waitable_timer(CREATE_WAITABLE_TIMER_HIGH_RESOLUTION)
+      if timer == C_NULL
+        # high resolution timers are only available on recent versions of
+        # Windows 10, fallback to a normal waitable timer
+        timer = create_waitable_timer(0x00000000)
+      end
+      if timer == C_NULL
+        error("Failed to create a waitable timer.")
+      end
+      waitable_timer[] = timer
+    end
+    waitable_timer[]
+  end
+
+  function precise_sleep(secs::Float64)
+    # negative values indicate a time relative to now, in units of 100ns
+    due = Ref(-round(Int64,secs*1e7))
+    timer = get_waitable_timer()
+    if ccall((:SetWaitableTimer,"kernel32"),stdcall,Cint,
+             (Ptr{Void},Ref{Int64},Clong,Ptr{Void},Ptr{Void},Cint),
+             timer,due,0,C_NULL,C_NULL,0) == 0
+      error("Failed to set a waitable timer.")
+    end
+    ccall((:WaitForSingleObject,"kernel32"),stdcall,UInt32,(Ptr{Void},UInt32),
+          timer,INFINITE)
+    nothing
+  end
+else
+  struct TimeSpec
+    sec::Int
+    nsec::Clong
+  end
+  function TimeSpec(secs::Float64)
+    sec = floor(Int,secs)
+    nsec = round(Clong,(secs - sec)*1e9)
+    # rounding up to a whole second would be an invalid number of nanoseconds
+    if nsec >= 1_000_000_000
+      sec += 1
+      nsec -= 1_000_000_000
+    end
+    TimeSpec(sec,nsec)
+  end
+
+  # when a signal interrupts the sleep, it is resumed for the time remaining
+  const EINTR = Cint(4)
+  @static if is_linux()
+    const CLOCK_MONOTONIC = Cint(1)
+    function precise_sleep(secs::Float64)
+      request = Ref(TimeSpec(secs))
+      remaining = Ref(TimeSpec(0,0))
+      while ccall(:clock_nanosleep,Cint,
+                  (Cint,Cint,Ref{TimeSpec},Ref{TimeSpec}),
+                  CLOCK_MONOTONIC,0,request,remaining) == EINTR
+        request[] = remaining[]
+      end
+      nothing
+    end
+  else
+    function precise_sleep(secs::Float64)
+      request = Ref(TimeSpec(secs))
+      remaining = Ref(TimeSpec(0,0))
+      while ccall(:nanosleep,Cint,(Ref{TimeSpec},Ref{TimeSpec}),
+                  request,remaining) == -1 && Libc.errno() == EINTR
+        request[] = remaining[]
+      end
+      nothing
+    end
+  end
+end
+
+# summary statistics of how accurately the run loop wakes up, relative to when
+# it asked to, when scheduling moments using `precise_sleep`.
+mutable struct WakeupStats
+  n::Int
+  mean::Float64
+  m2::Float64
+  max::Float64
+  late::Int
+end
+WakeupStats() = WakeupStats(0,0.0,0.0,-Inf,0)
+
+function record_wakeup!(stats::WakeupStats,error::Float64,window::Float64)
+  # Welford's online algorithm for the mean and variance
+  stats.n += 1
+  delta = error - stats.mean
+  stats.mean += delta / stats.n
+  stats.m2 += delta*(error - stats.mean)
+  stats.max = max(stats.max,error)
+  if error > window
+    stats.late += 1
+  end
+  stats
+end
+
+function Base.show(io::IO,stats::WakeupStats)
+  sd = stats.n > 1 ? sqrt(stats.m2 / (stats.n-1)) : NaN
+  write(io,"Wake-up error over $(stats.n) sleeps: "*
+        "mean = $(round(1000stats.mean,3))ms, sd = $(round(1000sd,3))ms, "*
+        "max = $(round(1000stats.max,3))ms, $(stats.late) woke after the "*
+        "spin window.")
+end
+
+# A histogram of durations using a fixed amount of memory, in the style of an
+# HDR histogram: durations are counted in microseconds, with 32 linearly
+# spaced buckets for each power of two, so that every duration is counted with
+# a relative error of at most ~3%, up to just over an hour.
+const histogram_sub_bits = 5
+const histogram_sub_count = 1 << histogram_sub_bits
+const histogram_magnitudes = 32
+
+mutable struct LatencyHistogram
+  counts::Vector{Int}
+  n::Int
+  min::Float64
+  max::Float64
+  total::Float64
+end
+LatencyHistogram() =
+  LatencyHistogram(zeros(Int,histogram_sub_count*
+                         (histogram_magnitudes - histogram_sub_bits + 1)),
+                   0,Inf,-Inf,0.0)
+
+function bucket_index(us::UInt64)
+  if us < 2histogram_sub_count
+    Int(us) + 1
+  else
+    shift = 63 - leading_zeros(us) - histogram_sub_bits
+    (shift+1)*histogram_sub_count + Int(us >> shift) - histogram_sub_count + 1
+  end
+end
+
+function bucket_value(i::Int)
+  if i <= 2histogram_sub_count
+    i - 1
+  else
+    shift = div(i-1,histogram_sub_count) - 1
+    (rem(i-1,histogram_sub_count) + histogram_sub_count) << shift
+  end
+end
+
+function observe!(h::LatencyHistogram,secs::Float64)
+  us = UInt64(round(clamp(secs,0.0,(2.0^histogram_magnitudes-1)*1e-6)*1e6))
+  @inbounds h.counts[bucket_index(us)] += 1
+  h.n += 1
+  h.min = min(h.min,secs)
+  h.max = max(h.max,secs)
+  h.total += secs
+  h
+end
+
+Base.mean(h::LatencyHistogram) = h.total / h.n
+function Base.quantile(h::LatencyHistogram,p::Real)
+  h.n == 0 && return NaN
+  rank = max(1,ceil(Int,p*h.n))
+  seen = 0
+  for i in eachindex(h.counts)
+    seen += h.counts[i]
+    if seen >= rank
+      return clamp(bucket_value(i)*1e-6,h.min,h.max)
+    end
+  end
+  h.max
+end
+
+# timing statistics about the run loop of an experiment (see
+# `Weber.run_stats`)
+mutable struct RunStats
+  moments::Dict{DataType,LatencyHistogram}
+  loop::LatencyHistogram
+  sleep::LatencyHistogram
+  stream::LatencyHistogram
+  present::LatencyHistogram
+end
+RunStats() = RunStats(Dict{DataType,LatencyHistogram}(),LatencyHistogram(),
+                      LatencyHistogram(),LatencyHistogram(),LatencyHistogram())
+
+function observe_moment!(stats::RunStats,moment,latency)
+  observe!(get!(LatencyHistogram,stats.moments,typeof(moment)),latency)
+end
+
+function stat_rows(stats::RunStats)
+  rows = ["loop" => stats.loop,"sleep_overshoot" => stats.sleep,
+          "stream_lateness" => stats.stream,"present" => stats.present]
+  for (T,h) in stats.moments
+    push!(rows,"latency_"*string(T.name.name) => h)
+  end
+  filter(x -> x[2].n > 0,rows)
+end
+
+const stat_quantiles = [0.5,0.9,0.99]
+
+function write_stats(io::IO,stats::RunStats)
+  println(io,"measure,n,min,mean,p50,p90,p99,max")
+  for (name,h) in stat_rows(stats)
+    println(io,join([name,h.n,h.min,mean(h),
+                     (quantile(h,p) for p in stat_quantiles)...,h.max],","))
+  end
+end
+
+function Base.show(io::IO,stats::RunStats)
+  ms(x) = string(round(1000x,3),"ms")
+  write(io,"Run loop timing (median, 99th percentile and maximum):")
+  for (name,h) in stat_rows(stats)
+    write(io,"\n  $name: $(ms(quantile(h,0.5))), $(ms(quantile(h,0.99))), "*
+          "$(ms(h.max)) over $(h.n) samples")
+  end
+end
@@ -2,51 +2,42 @@ using Lazy: @_
 using DataStructures
 using MacroTools
 import Base: run, display
-export addtrial, addbreak, addpractice, moment, await_response, record, timeout,
-  when, looping, @addtrials
+export addtrial, addtrials, addbreak, addpractice, moment, await_response,
+  record, timeout, when, looping, @addtrials
 
-function findkwd(kwds,sym,default)
-  for (k,v) in kwds
-    if k == sym
-      return v
-    end
-  end
-
-  default
+function write_record(exp::Experiment{NullWindow},plan::RecordPlan,row,code)
+  push!(win(exp).records,Dict{Symbol,Any}(c => row[i] for (c,i) in plan.slots))
 end
 
-const null_record = []
-function write_csv_line(exp::Experiment{NullWindow},header,kwds)
-  push!(null_record,Dict{Symbol,Any}(map(c -> c => findkwd(kwds,c,""),header)))
+function write_record(exp::Experiment{SDLWindow},plan::RecordPlan,row,code)
+  if !isnull(info(exp).file)
+    freeze_row!(row)
+    commit_record!(info(exp).records,code)
+  end
 end
 
-function write_csv_line(exp::Experiment{SDLWindow},header,kwds)
+record_row(exp::Experiment{NullWindow},plan::RecordPlan) = plan.scratch
+function record_row(exp::Experiment{SDLWindow},plan::RecordPlan)
   if !isnull(info(exp).file)
-    open(get(info(exp).file),"a") do stream
-      @_ (string(findkwd(kwds,c,"")) for c in header) begin
-        join(_,",")
-        println(stream,_)
-      end
-    end
+    next_row!(info(exp).records,length(plan.columns))
+  else
+    plan.scratch
   end
 end
 
-function record_helper(exp::Experiment,kwds,header)
-  columns = map(x -> x[1],kwds)
-
-  if !isempty(columns) && !all(map(c -> c ∈ header,columns))
-    missing = collect(Iterators.filter(c -> c ∉ header,columns))
-
-    error("Unexpected column $(length(missing) > 1 ? "s" : "")"*
-          "$(join(missing,", "," and ")). "*
-          "Make sure you specify all columns you plan to use "*
-          "during experiment initialization.")
+function record_plan(exp::Experiment)
+  plan = info(exp).record_plan
+  if !plan.compiled
+    extra = [:weber_version => Weber.version,
+             :start_date => Dates.format(info(exp).start,"yyyy-mm-dd"),
+             :start_time => Dates.format(info(exp).start,"HH:MM:SS"),
+             :offset => 0, :trial => 0, :time => 0.0]
+    extra_keys = map(x->x[1],extra)
+    info_keys = map(x->x[1],info(exp).values)
+    columns = Symbol[extra_keys...,info_keys...,:code,info(exp).header...]
+    compile!(plan,columns,[extra...,info(exp).values...])
   end
-
-  kwds = reverse(kwds) # this ensures that if the user overwrites a value
-                       # it will be honored
-
-  write_csv_line(exp,header,kwds)
+  plan
 end
 
 function record_header(exp::Experiment)
@@ -60,31 +51,39 @@ function record_header(exp::Experiment)
           " a different name.")
   elseif length(reserved) > 1
     error("The column names "*
-          join(map(x -> "\""*x*"\"",reserved),", "," and ")*
+          join(map(x -> "\""*string(x)*"\"",reserved),", "," and ")*
           " are reserved. Please use different names.")
   end
 
-  columns = [extra_keys...,info_keys...,:code,info(exp).header...]
-  if !isnull(info(exp).file)
-    open(x -> println(x,join(columns,",")),get(info(exp).file),"w")
-  end
+  plan = record_plan(exp)
+  open_records!(info(exp).records,plan.columns)
 end
 
 function record(exp::ExtendedExperiment,code;kwds...)
   record(next(exp),code;kwds...)
 end
 function record{T <: BaseExperiment}(exp::T,code;kwds...)
-  extra = [:weber_version => Weber.version,
-           :start_date => Dates.format(info(exp).start,"yyyy-mm-dd"),
-           :start_time => Dates.format(info(exp).start,"HH:MM:SS"),
-           :offset => data(exp).offset,
-           :trial => data(exp).trial,
-           :time => data(exp).last_time]
+  plan = record_plan(exp)
+  for (k,v) in kwds
+    haskey(plan.slots,k) || unknown_columns_error(plan,kwds)
+  end
 
-  info_keys = map(x->x[1],info(exp).values)
-  extra_keys = map(x->x[1],extra)
-  record_helper(exp,tuple(extra...,info(exp).values...,:code => code,kwds...),
-                [extra_keys...,info_keys...,:code,info(exp).header...])
+  row = record_row(exp,plan)
+  copy!(row,plan.fixed)
+  @inbounds begin
+    row[plan.offset_slot] = data(exp).offset
+    row[plan.trial_slot] = data(exp).trial
+    row[plan.time_slot] = data(exp).last_time
+    row[plan.code_slot] = code
+  end
+
+  # later keywords take precedence over earlier ones, so that a user can
+  # overwrite a value
+  for (k,v) in kwds
+    @inbounds row[plan.slots[k]] = v
+  end
+
+  write_record(exp,plan,row,code)
 end
 
 """
@@ -103,9 +102,12 @@ number, the version of Weber, and the time at which the last moment started are
 all stored.  Additional information can be added during creation of the
 experiment (see [`Experiment`](@ref)).
 
-Each call to record writes a new row to the data file used for the experiment, so
-there should be no loss of data if the program is terminated prematurely for
-some reason.
+Each call to record adds a new row to the data file used for the experiment.
+To avoid slowing down the timing of moments, rows are buffered and written to
+disk whenever the experiment has time to spare in between moments. The file is
+synchronized to disk at the start of each trial, practice or break, and when
+the experiment is terminated or closed. If the program crashes, the rows
+recorded since they were last written to disk are lost.
 
 !!! note "Automatically Recorded Codes"
 
@@ -124,6 +126,9 @@ some reason.
     7. **terminated** - recorded when the user manually terminates the
        experiment (via 'escape')
     8. **closed** - recorded just before the experiment window closes
+    9. **stream_underrun** - recorded when a [`stream`](@ref) could not generate
+       its sound quickly enough. The "value" column is set to the duration of
+       the resulting gap in the sound, in seconds.
 """
 function record(code;kwds...)
   record(get_experiment(),code;kwds...)
@@ -152,8 +157,39 @@ function addmoment(q::Vector{AbstractMoment},m::AbstractMoment)
 end
 
 addmoment(e::Experiment,m) = addmoment(data(e).moments,m)
-addmoment(q::Array{MomentQueue},m::AbstractMoment) = addmoment(first(q),m)
-function addmoment(q::Union{ExpandingMoment,MomentQueue,Array{MomentQueue}},watcher::Function)
+function addmoment(qs::MomentQueues,m::AbstractMoment)
+  q = first(qs)
+  addmoment(q,m)
+  index_offset!(qs.offsets,m,length(q))
+  q
+end
+
+index_offset!(index::OffsetIndex,m::AbstractMoment,position) = index
+function index_offset!(index::OffsetIndex,m::OffsetStartMoment,position)
+  if index.stop == 0
+    if !m.expanding
+      push!(index.positions,position)
+      push!(index.trials,index.n_trials)
+    end
+    index.n_trials += m.count_trials
+  end
+  index
+end
+function index_offset!(index::OffsetIndex,m::ExpandingMoment,position)
+  if index.stop == 0 && m.update_offset
+    push!(index.positions,position)
+    push!(index.trials,index.n_trials)
+  end
+  index
+end
+function index_offset!(index::OffsetIndex,m::TrialSource,position)
+  if index.stop == 0 && !m.expanding
+    index.stop = position
+  end
+  index
+end
+function addmoment(q::Union{ExpandingMoment,MomentQueue,MomentQueues,
+                            Vector{AbstractMoment}},watcher::Function)
   for t in concrete_events
     precompile(watcher,(t,))
   end
@@ -190,12 +226,13 @@ function addmoment(q,ms)
   q
 end
 
-const addtrial_block = Stack(ExpandingMoment)
+# the blocks (see `@addtrials`) currently being setup for an experiment
 function addmoments(exp,moments)
-  if isempty(addtrial_block)
+  blocks = data(exp).blocks
+  if isempty(blocks)
     foreach(m -> addmoment(exp,m),moments)
   else
-    block = top(addtrial_block)
+    block = top(blocks)
     foreach(m -> addmoment(block,m),moments)
   end
 end
@@ -280,9 +317,9 @@ end
 
 function trial_block(exp::Experiment,body::Function,condition::Function;loop=false)
   moment = ExpandingMoment(condition,Stack(AbstractMoment),loop,true)
-  push!(addtrial_block,moment)
+  push!(data(exp).blocks,moment)
   body()
-  pop!(addtrial_block)
+  pop!(data(exp).blocks)
 
   addmoments(exp,[moment])
 end
@@ -309,6 +346,7 @@ end
 
 function addtrial_helper(exp::Experiment,start_code,moments)
   start_trial = offset_start_moment(start_code == "trial_start") do
+    trial_boundary(get_experiment())
     record(start_code)
   end
 
@@ -316,6 +354,57 @@ function addtrial_helper(exp::Experiment,start_code,moments)
 end
 
 
+const default_trial_lookahead = 4
+
+"""
+    addtrials(itr;[lookahead=4])
+    addtrials(fn,itr;[lookahead=4])
+
+Adds one trial to the experiment for each element of `itr`, creating the
+trials' moments only as the experiment reaches them, rather than all at once
+during `setup`. Each element of `itr` should be a moment, or several moments
+(e.g. a tuple or array), specifying one trial, as would be passed to
+[`addtrial`](@ref). When a function is passed, it is called with each element
+of `itr` and should return the moments of that trial. For instance, the
+following code creates 10000 trials without building all of their moments and
+stimuli up front.
+
+    addtrials(1:10000) do i
+      stimulus = tone(1kHz + i*Hz,100ms)
+      moment(0.5s,play,stimulus),moment(0.5s,record,"stimulus",value=i)
+    end
+
+Trials are created `lookahead` trials at a time, just after the previous set of
+trials has finished. Elements of a generator (such as `(f(x) for x in xs)`)
+are computed at this point, so you can also pass a generator to `addtrials`.
+
+When trials are skipped (see the `skip` keyword of [`Experiment`](@ref)) the
+moments of the skipped trials are never created: `fn` is not called for those
+elements.
+"""
+function addtrials(itr;keys...)
+  addtrials(get_experiment(),itr;keys...)
+end
+addtrials(fn::Function,itr;keys...) = addtrials(Base.Generator(fn,itr);keys...)
+
+addtrials(exp::ExtendedExperiment,itr;keys...) = addtrials(next(exp),itr;keys...)
+function addtrials{T <: BaseExperiment}(exp::T,itr;
+                                        lookahead=default_trial_lookahead)
+  lookahead > 0 || error("Expected a positive `lookahead`, got $lookahead.")
+  addmoments(exp,[trial_source(itr,lookahead)])
+end
+
+trial_source(itr::Base.Generator,lookahead) = trial_source(itr.f,itr.iter,lookahead)
+trial_source(itr,lookahead) = trial_source(identity,itr,lookahead)
+function trial_source(fn,itr,lookahead)
+  # the same start moment is shared by all trials of the source
+  start_trial = offset_start_moment(true) do
+    trial_boundary(get_experiment())
+    record("trial_start")
+  end
+  TrialSource(fn,itr,false,nothing,lookahead,false,start_trial)
+end
+
 """
     addpractice(moments...)
 
@@ -352,11 +441,21 @@ Create a moment that occurs `delta_t` (default 0) seconds after the onset of
 the previous moment, running the specified function.
 
 The function `fn` is passed the arguments specified in `args` and `keys`.
+
+    moment([delta_t],display,x;[flip=false],keys...)
+
+When displaying a visual, passing `flip=true` aligns the moment to the screen
+refresh (the "flip") nearest to `delta_t`, rather than the first refresh after
+`delta_t` has passed. The time at which the visual actually appeared is recorded
+under the code "flip" (with the difference from the intended onset stored in the
+`value` column), and any refreshes missed when showing the visual are recorded
+under the code "missed_frames" (see [`record`](@ref)). Subsequent moments are
+timed relative to the intended onset.
 """
 function moment(delta_t::Number=0.0s,fn::Function=()->nothing,args...;keys...)
   precompile(fn,map(typeof,args))
   delta_t = ustrip(inseconds(delta_t))
-  TimedMoment(delta_t,() -> fn(args...;keys...),stacktrace()[2:end])
+  TimedMoment(delta_t,() -> fn(args...;keys...),capture_trace())
 end
 
 function moment(fn::Function,args...;keys...)
@@ -365,24 +464,29 @@ end
 
 const PlayFunction = typeof(play)
 function moment(delta_t::Number,::PlayFunction,x;channel=0)
-  PlayMoment(ustrip(inseconds(delta_t)),playable(x),channel,stacktrace()[2:end])
+  PlayMoment(ustrip(inseconds(delta_t)),playable(x),channel,capture_trace())
 end
 function moment(delta_t::Number,::PlayFunction,fn::Function;channel=0)
-  PlayFunctionMoment(ustrip(inseconds(delta_t)),fn,channel,stacktrace()[2:end])
+  PlayFunctionMoment(ustrip(inseconds(delta_t)),fn,channel,capture_trace())
 end
 
-# const StreamFunction = typeof(TimedSound.stream)
-# function moment(delta_t::Number,::StreamFunction,itr,channel::Int)
-#   StreamMoment(ustrip(inseconds(delta_t)),itr,channel,stacktrace()[2:end])
-# end
+const StreamFunction = typeof(stream)
+function moment(delta_t::Number,::StreamFunction,itr;channel=1,
+                lead=default_stream_lead,buffer=default_stream_buffer)
+  StreamMoment(ustrip(inseconds(delta_t)),itr,channel,ustrip(inseconds(lead)),
+               buffer,capture_trace())
+end
 
 const DisplayFunction = typeof(display)
-function moment(delta_t::Number,::DisplayFunction,x;keys...)
-  DisplayMoment(ustrip(inseconds(delta_t)),visual(x;keys...),stacktrace()[2:end])
+function moment(delta_t::Number,::DisplayFunction,x;flip=false,keys...)
+  DisplayMoment(ustrip(inseconds(delta_t)),visual(x;keys...),capture_trace(),
+                flip,flip_lead(flip))
 end
-function moment(delta_t::Number,::DisplayFunction,fn::Function;keys...)
-  DisplayFunctionMoment(ustrip(inseconds(delta_t)),fn,keys,stacktrace()[2:end])
+function moment(delta_t::Number,::DisplayFunction,fn::Function;flip=false,keys...)
+  DisplayFunctionMoment(ustrip(inseconds(delta_t)),fn,keys,capture_trace(),
+                        Nullable(),flip,flip_lead(flip))
 end
+flip_lead(flip) = flip ? frame_period(win(get_experiment()))/2 : 0.0
 
 """
     moment(moments...)
@@ -403,7 +507,7 @@ end
 
 function offset_start_moment(fn::Function=()->nothing,count_trials=false)
   precompile(fn,(Float64,))
-  OffsetStartMoment(fn,count_trials,false,stacktrace()[2:end])
+  OffsetStartMoment(fn,count_trials,false,capture_trace())
 end
 
 """
@@ -412,7 +516,7 @@ end
 This moment starts when the `isresponse` function evaluates to true.
 
 The `isresponse` function will be called anytime an event occurs. It should
-take one parameter (the event that just occured).
+take one parameter (the event that just occurred).
 
 If the response is provided before `atleast` seconds, the moment does not start
 until `atleast` seconds have passed.
@@ -422,7 +526,7 @@ function await_response(fn::Function;atleast=0.0)
     precompile(fn,(t,))
   end
 
-  ResponseMoment(fn,() -> nothing,0,atleast,stacktrace()[2:end])
+  ResponseMoment(fn,() -> nothing,0,atleast,capture_trace())
 end
 
 """
@@ -432,7 +536,7 @@ This moment starts when either `isresponse` evaluates to true or
 timeout time (in seconds) passes.
 
 The `isresponse` function will be called anytime an event occurs. It should
-take one parameter (the event that just occured).
+take one parameter (the event that just occurred).
 
 If the moment times out, the function `fn` (with no arguments) will be called.
 
@@ -446,10 +550,14 @@ function timeout(fn::Function,isresponse::Function,timeout;atleast=0.0s)
   end
 
   ResponseMoment(isresponse,fn,ustrip(inseconds(timeout)),
-                 ustrip(inseconds(atleast)),stacktrace()[2:end])
+                 ustrip(inseconds(atleast)),capture_trace())
 end
 
 flag_expanding(m::AbstractMoment) = m
+function flag_expanding(m::TrialSource)
+  TrialSource(m.fn,m.itr,m.started,m.state,m.lookahead,true,
+              flag_expanding(m.start_trial))
+end
 function flag_expanding(m::OffsetStartMoment)
   OffsetStartMoment(m.run,m.count_trials,true,m.trace)
 end
@@ -519,8 +627,11 @@ function prepare!(ms::MomentSequence,onset_s::Float64)
   for m in ms.data prepare!(m,onset_s) end
 end
 
+prepare!(m::DisplayMoment) = prepare_visual!(m.visual)
 function prepare!(m::DisplayFunctionMoment)
-  m.visual = Nullable(visual(m.fn();m.keys...))
+  if isnull(m.visual)
+    m.visual = Nullable(visual(m.fn();m.keys...))
+  end
 end
 
 function prepare!(m::PlayMoment,onset_s::Float64)
@@ -532,19 +643,69 @@ function prepare!(m::PlayMoment,onset_s::Float64)
 end
 
 function prepare!(m::PlayFunctionMoment,onset_s::Float64)
+  m.scheduled = true
   if !isinf(onset_s)
-    TimedSound.play_(playable(m.fn()),onset_s,m.channel)
+    TimedSound.play_(take_sound!(m),onset_s,m.channel)
   else
-    m.prepared = Nullable(playable(m.fn()))
+    m.prepared = Nullable(take_sound!(m))
+  end
+end
+
+# the sound generated by `prepare_early!`, if any, is used only once, so that
+# a moment presented several times calls its function each time.
+function take_sound!(m::PlayFunctionMoment)
+  if isnull(m.sound)
+    playable(m.fn())
+  else
+    sound = get(m.sound)
+    m.sound = Nullable()
+    sound
+  end
+end
+
+"""
+    Weber.prepare_early!(m)
+
+Called for moments that are due within the `prepare_horizon` of an experiment
+(see [`Experiment`](@ref)), during the idle time of the experiment, possibly
+several times, before [`Weber.prepare!`](@ref) is called. This can be used to do
+any slow work needed by `prepare!` ahead of time. The default implementation
+does nothing.
+
+!!! note
+
+    This method is part of the private interface for moments. It
+    should not be called directly, but implemented as part of an extension.
+"""
+prepare_early!(m::AbstractMoment) = nothing
+prepare_early!(ms::MomentSequence) = foreach(prepare_early!,ms.data)
+# once `prepare!` has used the sound, the moment stays at the front of its
+# queue until its onset: it must not generate another sound in the meantime.
+function prepare_early!(m::PlayFunctionMoment)
+  if isnull(m.sound) && !m.scheduled
+    m.sound = Nullable(playable(m.fn()))
   end
 end
+prepare_early!(m::DisplayFunctionMoment) = prepare!(m)
+
+# the start of the stream is generated during prepare!, so that it is ready
+# to play at the moment's onset
+function prepare!(m::StreamMoment,onset_s::Float64)
+  s = fill_stream!(SoundStream(m.itr,m.lead,m.buffer_size))
+  s.next_onset = onset_s
+  m.prepared = Nullable(s)
+end
 
 run(exp,q,m::TimedMoment) = m.run()
 run(exp,q,m::OffsetStartMoment) = m.run()
 run(exp,q,m::MomentSequence) = foreach(x -> run(exp,q,x),m.data)
 
 run(exp,q,m::DisplayMoment) = display(win(exp),m.visual)
-run(exp,q,m::DisplayFunctionMoment) = display(win(exp),get(m.visual))
+function run(exp,q,m::DisplayFunctionMoment)
+  rendered = get(m.visual)
+  m.visual = Nullable()
+  display(win(exp),rendered)
+end
 
 function run(exp,q,m::PlayMoment)
   if m.prepared
@@ -553,7 +714,18 @@ function run(exp,q,m::PlayMoment)
   end
 end
 
+function run(exp,q,m::StreamMoment)
+  s = if isnull(m.prepared)
+    fill_stream!(SoundStream(m.itr,m.lead,m.buffer_size))
+  else
+    get(m.prepared)
+  end
+  m.prepared = Nullable()
+  start_stream!(exp,m.channel,s,isinf(s.next_onset) ? tick(exp) : s.next_onset)
+end
+
 function run(exp,q,m::PlayFunctionMoment)
+  m.scheduled = false
   if !isnull(m.prepared)
     TimedSound.play_(get(m.prepared),0.0,m.channel)
     m.prepared = Nullable()
@@ -571,7 +743,7 @@ reached for the next moment to be presented (according to [`delta_t`](@ref)) or
 when an event occurs.
 
 The `to_handle` object is either a `Float64`, indicating the current experiment
-time, or it is an `ExpEvent` indicating the event that just occured. As an
+time, or it is an `ExpEvent` indicating the event that just occurred. As an
 example, a timed moment, will run when it recieves any `Float64` value, but
 nothing occurs when passed an event.
 
@@ -600,12 +772,39 @@ function handle(exp::Experiment,q::MomentQueue,
   true
 end
 
-# function handle(exp::Experiment,q::MomentQueue,
-#                 moment::StreamMoment,time::Float64)
-#   stream(moment.itr,moment.channel)
-#   dequeue!(q)
-#   true
-# end
+
+function handle(exp::Experiment,q::MomentQueue,moment::AnyDisplayMoment,
+                time::Float64)
+  if moment.flip
+    presented = presents(win(exp))
+    started = precise_time()
+    run(exp,q,moment)
+    flip = time + (precise_time() - started)
+    onset = time + (moment.delta_t - delta_t(moment))
+    # redisplaying the visual already on screen doesn't present a new frame
+    presented_since(win(exp),presented) && record_flip(exp,flip,onset)
+    q.last = onset
+  else
+    run(exp,q,moment)
+    q.last = time
+  end
+  dequeue!(q)
+  true
+end
+
+# with vsync enabled, the display is blocked until the screen is refreshed, so
+# the time at which `display` returns is the time of the flip
+function record_flip(exp,flip,onset)
+  period = frame_period(win(exp))
+  record(top(exp),"flip",time=flip,value=flip - onset)
+  if period > 0
+    missed = floor(Int,(flip - onset)/period + 0.5)
+    if missed > 0
+      win(exp).missed_frames += missed
+      record(top(exp),"missed_frames",value=missed)
+    end
+  end
+end
 
 function handle(exp::Experiment,q::MomentQueue,
                 moment::AbstractTimedMoment,event::ExpEvent)
@@ -643,8 +842,9 @@ function handle(exp::Experiment,q::MomentQueue,
 end
 
 function handle(exp::Experiment,q::MomentQueue,moments::CompoundMoment,x)
-  compq = MomentQueue(moments.data,q.last)
-  push!(data(exp).moments,compq)
+  queues = data(exp).moments
+  compq = pooled_queue!(queues,moments.data,q.last)
+  push!(queues,compq)
   prepare!(compq,q.last)
   dequeue!(q)
   true
@@ -656,9 +856,8 @@ function handle(exp::Experiment,q::MomentQueue,m::ExpandingMoment,x)
       dequeue!(q)
     end
 
-    for x in m.data
-      unshift!(q,x)
-    end
+    reserve!(q,length(q) + length(m.data) + 1)
+    unshift_each!(q,m.data)
     unshift!(q,expanding_stub)
   else
     dequeue!(q)
@@ -666,12 +865,50 @@ function handle(exp::Experiment,q::MomentQueue,m::ExpandingMoment,x)
   true
 end
 
+function handle(exp::Experiment,q::MomentQueue,m::TrialSource,x)
+  dequeue!(q)
+
+  trials = AbstractMoment[]
+  n = 0
+  state = m.started ? m.state : start(m.itr)
+  while n < m.lookahead && !done(m.itr,state)
+    x, state = next(m.itr,state)
+
+    # skipped trials are only counted, their moments are never created
+    if !m.expanding && data(exp).offset + 1 < data(exp).skip_offsets
+      data(exp).offset += 1
+      data(exp).trial += 1
+    else
+      addmoment(trials,[m.start_trial,m.fn(x)])
+      n += 1
+    end
+  end
+
+  # the remaining trials come from a new source, leaving `m` as it was, ready
+  # to start over if it is reached again
+  more = !done(m.itr,state)
+  reserve!(q,length(q) + length(trials) + more + 1)
+  if more
+    unshift!(q,TrialSource(m.fn,m.itr,true,state,m.lookahead,m.expanding,
+                           m.start_trial))
+  end
+  for i in length(trials):-1:1
+    unshift!(q,trials[i])
+  end
+  unshift!(q,expanding_stub)
+  true
+end
+
 function handle(exp::Experiment,q::MomentQueue,m::ExpandingMomentStub,x)
   dequeue!(q)
   true
 end
 
 is_moment_skipped(exp,moment::AbstractMoment) = data(exp).offset < data(exp).skip_offsets
+function is_moment_skipped(exp,moment::TrialSource)
+  # the source skips its own trials, as it creates them
+  moment.expanding && data(exp).offset < data(exp).skip_offsets
+end
 function is_moment_skipped(exp,moment::OffsetStartMoment)
   if !moment.expanding
     data(exp).offset += 1
@@ -690,3 +927,66 @@ function is_moment_skipped(exp,moment::ExpandingMoment)
   end
   data(exp).offset < data(exp).skip_offsets
 end
+
+# Compile the methods used to present every kind of moment in the experiment
+# before it runs: otherwise the first occurrence of each new type of moment (or
+# of each new closure passed to `moment`) pays the cost of JIT compilation
+# during the trial, and leads to unpredictable latencies.
+function precompile_moments(exp::Experiment)
+  moment_types = Set{DataType}()
+  closures = Dict{DataType,Function}()
+  for queue in data(exp).moments
+    foreach(m -> collect_moment_types!(moment_types,closures,m),queue)
+  end
+
+  exp_types = unique([typeof(exp),typeof(top(exp))])
+  for E in exp_types, M in moment_types
+    precompile(is_moment_skipped,(E,M))
+    precompile(handle,(E,MomentQueue,M,Float64))
+    for t in concrete_events
+      precompile(handle,(E,MomentQueue,M,t))
+    end
+    if M <: AbstractTimedMoment
+      precompile(run,(E,MomentQueue,M))
+    end
+  end
+  for M in moment_types
+    precompile(delta_t,(M,))
+    precompile(required_delta_t,(M,))
+    precompile(prepare!,(M,Float64))
+  end
+
+  # the closures of response moments are compiled when they're created (see
+  # `timeout` and `await_response`), the remaining closures take no arguments
+  for fn in values(closures)
+    precompile(fn,())
+  end
+
+  nothing
+end
+
+collect_moment_types!(ms,fs,m::AbstractMoment) = push!(ms,typeof(m))
+function collect_moment_types!(ms,fs,m::Union{TimedMoment,OffsetStartMoment})
+  push!(ms,typeof(m))
+  collect_closure_type!(fs,m.run)
+end
+function collect_moment_types!(ms,fs,m::ResponseMoment)
+  push!(ms,typeof(m))
+  collect_closure_type!(fs,m.timeout)
+end
+function collect_moment_types!(ms,fs,m::Union{PlayFunctionMoment,
+                                              DisplayFunctionMoment})
+  push!(ms,typeof(m))
+  collect_closure_type!(fs,m.fn)
+end
+function collect_moment_types!(ms,fs,
+                               m::Union{CompoundMoment,MomentSequence})
+  push!(ms,typeof(m))
+  foreach(x -> collect_moment_types!(ms,fs,x),m.data)
+end
+function collect_moment_types!(ms,fs,m::ExpandingMoment)
+  push!(ms,typeof(m))
+  collect_closure_type!(fs,m.condition)
+  foreach(x -> collect_moment_types!(ms,fs,x),m.data)
+end
+collect_closure_type!(fs,fn::Function) = get!(fs,typeof(fn),fn)
@@ -1,5 +1,5 @@
 import Base: show, isempty, time, >>, length, unshift!, promote_rule, convert,
-  hash, ==, isless, pop!, info, next, start, done, next, getindex
+  hash, ==, isless, pop!, info, next, start, done, next, getindex, first
 import DataStructures: front, back, top
 using MacroTools
 
@@ -68,10 +68,12 @@ end
 """
     time(e::ExpEvent)
 
-Get the time an event occured relative to the start of the experiment.
-Resolution is limited by an experiment's input_resolution (which can be
-specified upon initialization), and the response rate of the device. For
-instance, keyboards usually have a latency on the order of 20-30ms.
+Get the time an event occurred relative to the start of the experiment.
+Events are checked for every `input_resolution` seconds (see
+[`Experiment`](@ref)), and an event is usually given the time it was found at,
+so event times are precise to about `input_resolution` (1ms by default).
+Resolution is also limited by the response rate of the device. For instance,
+keyboards usually have a latency on the order of 20-30ms.
 """
 time(event::ExpEvent) = NaN
 time(event::KeyUpEvent) = event.time
@@ -307,6 +309,10 @@ iskeydown(key::KeyboardKey) = e -> iskeydown(e,key::KeyboardKey)
 iskeydown(event::ExpEvent,keycode::Key) = false
 iskeydown(event::KeyDownEvent,key::KeyboardKey) = event.code == key.code
 
+# used to simulate key presses (see the `observer` keyword of `Experiment`)
+KeyDownEvent(key::KeyboardKey,time::Float64) =
+  KeyDownEvent(reinterpret(UInt32,key.code),0x0000,time)
+
 """
     modifiedby([event],[modifier = :shift,:ctrl,:alt or :gui])
 
@@ -396,26 +402,88 @@ can_continue_sequence(m::AbstractMoment) = false
 sequenceable(m::AbstractMoment) = false
 warn_delta_t(m::AbstractMoment) = 0.0 < required_delta_t(m) < Inf
 
+# Where a moment was created. Converting a backtrace to a stacktrace is slow,
+# so each moment only stores a reference to the (interned) backtrace where it
+# was created, which is converted to a stacktrace when first needed.
+struct MomentTrace
+  id::Int
+end
+const no_trace = MomentTrace(0)
+const moment_backtraces = Vector{Vector{Ptr{Void}}}()
+const moment_trace_ids = Dict{Vector{Ptr{Void}},Int}()
+const moment_stacktraces = Dict{Int,StackTrace}()
+# the tables above are shared by all experiments
+const moment_trace_lock = ReentrantLock()
+
+# how moment traces are captured by the current experiment, see the
+# `moment_traces` keyword of `Experiment`. Moments created outside of an
+# experiment have compact traces.
+function moment_trace_mode()
+  context = current_context()
+  isnull(context) ? :compact : info(get(context)).moment_traces
+end
+
+"""
+    Weber.capture_trace()
+
+Captures a compact trace of where a moment is being created. It should be
+called within the function that creates the moment (see
+[`moment_trace`](@ref)).
+"""
+@noinline function capture_trace()
+  mode = moment_trace_mode()
+  mode == :none && return no_trace
+  bt = backtrace()
+  id = with_lock(moment_trace_lock) do
+    get!(moment_trace_ids,bt) do
+      push!(moment_backtraces,bt)
+      length(moment_backtraces)
+    end
+  end
+  trace = MomentTrace(id)
+  mode == :full && stack_trace(trace)
+  trace
+end
+
+Base.isempty(trace::MomentTrace) = trace.id == 0
+
+# convert a moment's trace to a stacktrace
+stack_trace(trace) = trace
+function stack_trace(trace::MomentTrace)
+  isempty(trace) && return StackFrame[]
+  with_lock(moment_trace_lock) do
+    get!(moment_stacktraces,trace.id) do
+      frames = stacktrace(moment_backtraces[trace.id])
+      # remove the frames for capture_trace, and the function creating the
+      # moment
+      i = findlast(f -> f.func == :capture_trace,frames)
+      frames[min(end+1,i+2):end]
+    end
+  end
+end
+
 """
     moment_trace(m)
 
-Returns the stacktrace indicating where this moment was defined.
+Returns the trace indicating where this moment was defined. This is either a
+stacktrace or a compact `Weber.MomentTrace`.
 
 !!! note
 
     This method is part of the private interface for moments. It should not be
-    called directly, but implemented as part of an extension.  You can get a
-    stacktrace inside the function you define that constructs your custom moment
-    using `stacktrace()[2:end]`.
+    called directly, but implemented as part of an extension. You can get a
+    trace inside the function you define that constructs your custom moment
+    using [`Weber.capture_trace`](@ref) (or, more slowly, using
+    `stacktrace()[2:end]`).
 """
-moment_trace(m::AbstractMoment) = Vector{StackFrame}()
+moment_trace(m::AbstractMoment) = no_trace
 
 struct ResponseMoment <: SimpleMoment
   respond::Function
   timeout::Function
   timeout_delta_t::Float64
   minimum_delta_t::Float64
-  trace::StackTrace
+  trace::MomentTrace
 end
 function delta_t(moment::ResponseMoment)
   (moment.timeout_delta_t > 0.0 ? moment.timeout_delta_t : Inf)
@@ -426,7 +494,7 @@ moment_trace(m::ResponseMoment) = m.trace
 
 struct ResponseMomentMin <: SimpleMoment
   delta_t::Float64
-  trace::StackTrace
+  trace::MomentTrace
 end
 delta_t(m::ResponseMomentMin) = m.delta_t
 required_delta_t(m::ResponseMomentMin) = Inf
@@ -440,7 +508,7 @@ can_continue_sequence(m::AbstractTimedMoment) = delta_t(m) == 0.0
 struct TimedMoment <: AbstractTimedMoment
   delta_t::Float64
   run::Function
-  trace::StackTrace
+  trace::MomentTrace
 end
 delta_t(moment::TimedMoment) = moment.delta_t
 sequenceable(m::TimedMoment) = true
@@ -450,7 +518,7 @@ struct OffsetStartMoment <: AbstractTimedMoment
   run::Function
   count_trials::Bool
   expanding::Bool
-  trace::StackTrace
+  trace::MomentTrace
 end
 delta_t(moment::OffsetStartMoment) = 0.0
 can_continue_sequence(m::OffsetStartMoment) = false
@@ -461,7 +529,7 @@ mutable struct PlayMoment <: AbstractTimedMoment
   delta_t::Float64
   sound::TimedSound.Sound
   channel::Int
-  trace::StackTrace
+  trace::MomentTrace
   prepared::Bool
 end
 PlayMoment(d,f,c,t) = PlayMoment(d,f,c,t,false)
@@ -474,47 +542,83 @@ mutable struct PlayFunctionMoment <: AbstractTimedMoment
   delta_t::Float64
   fn::Function
   channel::Int
-  trace::StackTrace
+  trace::MomentTrace
   prepared::Nullable{TimedSound.Sound}
+  sound::Nullable{TimedSound.Sound}
+  scheduled::Bool
 end
-PlayFunctionMoment(d,f,c,t) = PlayFunctionMoment(d,f,c,t,Nullable())
+PlayFunctionMoment(d,f,c,t) =
+  PlayFunctionMoment(d,f,c,t,Nullable(),Nullable(),false)
 delta_t(m::PlayFunctionMoment) = m.delta_t
 sequenceable(m::PlayFunctionMoment) = true
 moment_trace(m::PlayFunctionMoment) = m.trace
 warn_delta_t(m::PlayFunctionMoment) = false
 
-struct StreamMoment <: AbstractTimedMoment
+# a stream of sounds, generated from an iterator, which are played one after the
+# other (see `stream`). Chunks are generated ahead of time into a ring buffer,
+# and handed to TimedSound, with their onsets, `lead` seconds before they are due.
+mutable struct SoundStream
+  itr
+  state
+  finished::Bool
+  buffer::Vector{TimedSound.Sound}
+  first::Int
+  count::Int
+  lead::Float64
+  next_onset::Float64
+  paused::Float64
+  scheduled::Int
+  underruns::Int
+end
+function SoundStream(itr,lead,size)
+  SoundStream(itr,start(itr),false,Vector{TimedSound.Sound}(size),1,0,
+              lead,Inf,NaN,0,0)
+end
+
+mutable struct StreamMoment <: AbstractTimedMoment
   delta_t::Float64
   itr
   channel::Int
-  trace::StackTrace
+  lead::Float64
+  buffer_size::Int
+  trace::MomentTrace
+  prepared::Nullable{SoundStream}
 end
-delta_t(m::StreamMoment) = delta_t
-required_delta_t(m::StreamMoment) = Inf
+StreamMoment(d,i,c,l,b,t) = StreamMoment(d,i,c,l,b,t,Nullable())
+delta_t(m::StreamMoment) = m.delta_t
 can_continue_sequence(m::StreamMoment) = false
 sequenceable(m::StreamMoment) = false
+warn_delta_t(m::StreamMoment) = false
 moment_trace(m::StreamMoment) = m.trace
 
+# display moments with `flip` set are started `flip_lead` seconds early (half a
+# frame), so that the screen refresh their visual appears on is the one nearest
+# to their onset.
 struct DisplayMoment <: AbstractTimedMoment
   delta_t::Float64
   visual::SDLRendered
-  trace::StackTrace
+  trace::MomentTrace
+  flip::Bool
+  flip_lead::Float64
 end
-delta_t(m::DisplayMoment) = m.delta_t
-sequenceable(m::DisplayMoment) = true
-moment_trace(m::DisplayMoment) = m.trace
+DisplayMoment(d,v,t) = DisplayMoment(d,v,t,false,0.0)
 
-struct DisplayFunctionMoment <: AbstractTimedMoment
+mutable struct DisplayFunctionMoment <: AbstractTimedMoment
   delta_t::Float64
   fn::Function
   keys::Vector
-  trace::StackTrace
+  trace::MomentTrace
   visual::Nullable{SDLRendered}
+  flip::Bool
+  flip_lead::Float64
 end
-DisplayFunctionMoment(d,f,k,t) = DisplayFunctionMoment(d,f,k,t,Nullable())
-delta_t(m::DisplayFunctionMoment) = m.delta_t
-sequenceable(m::DisplayFunctionMoment) = true
-moment_trace(m::DisplayFunctionMoment) = m.trace
+DisplayFunctionMoment(d,f,k,t) = DisplayFunctionMoment(d,f,k,t,Nullable(),false,0.0)
+
+const AnyDisplayMoment = Union{DisplayMoment,DisplayFunctionMoment}
+delta_t(m::AnyDisplayMoment) = max(0.0,m.delta_t - m.flip_lead)
+sequenceable(m::AnyDisplayMoment) = !m.flip
+can_continue_sequence(m::AnyDisplayMoment) = !m.flip && m.delta_t == 0.0
+moment_trace(m::AnyDisplayMoment) = m.trace
 
 struct CompoundMoment <: AbstractMoment
   data::Array{AbstractMoment}
@@ -557,6 +661,23 @@ delta_t(m::ExpandingMomentStub) = 0.0
 required_delta_t(m::ExpandingMomentStub) = Inf
 can_continue_sequence(m::ExpandingMomentStub) = false
 
+# a source of trials that are only created as the experiment reaches them (see
+# `addtrials`). A source which hasn't started starts over from the beginning of
+# `itr` each time it is reached, so that a source within an `@addtrials` loop
+# creates its trials on every iteration.
+struct TrialSource <: AbstractMoment
+  fn::Function
+  itr
+  started::Bool
+  state
+  lookahead::Int
+  expanding::Bool
+  start_trial::AbstractMoment
+end
+delta_t(m::TrialSource) = 0.0
+required_delta_t(m::TrialSource) = Inf
+can_continue_sequence(m::TrialSource) = false
+
 struct EmptyMoment <: AbstractMoment end
 empty_moment = EmptyMoment()
 
@@ -566,7 +687,15 @@ mutable struct MomentQueue
   start_index::Int
   end_index::Int
   very_first::Bool
+  # position of the queue in the deadline heap of `MomentQueues` (0 when the
+  # queue is not in the heap), the time its front moment is due, and the
+  # order in which the queue was added
+  heap_index::Int
+  deadline::Float64
+  order::Int
 end
+MomentQueue(data,last,start_index,end_index,very_first) =
+  MomentQueue(data,last,start_index,end_index,very_first,0,Inf,0)
 show(io::IO,q::MomentQueue) = write(io,"MomentQueue[$(join(q,","))]")
 start(m::MomentQueue) = 1
 done(m::MomentQueue,i::Int) = i > length(m)
@@ -608,7 +737,7 @@ function resize!(mq::MomentQueue,n)
   mq.data = new_data
   end_index = length(mq)
   mq.start_index = 1
-  mq.end_index = end_index
+  mq.end_index = max(1,end_index)
 
   mq
 end
@@ -652,6 +781,34 @@ function unshift!(m::MomentQueue,x)
   m
 end
 
+# remove the first n moments of the queue, without looking at them
+function drop!(m::MomentQueue,n)
+  for i in 1:min(n,length(m))
+    m.data[m.start_index] = empty_moment
+    if m.start_index != m.end_index
+      m.start_index = m.start_index < length(m.data) ? m.start_index + 1 : 1
+    end
+  end
+  m
+end
+
+# unshift each of `xs` to the front of the queue, in order, so that the last
+# element ends up at the front. The queue grows at most once.
+function unshift_each!(m::MomentQueue,xs,n=length(xs))
+  reserve!(m,length(m) + n)
+  for x in xs
+    unshift!(m,x)
+  end
+  m
+end
+
+function reserve!(m::MomentQueue,n)
+  if n > length(m.data)
+    resize!(m,nextpow2(n))
+  end
+  m
+end
+
 function pop!(m::MomentQueue)
   @assert !isempty(m)
   result = m.data[m.end_index]
@@ -677,6 +834,160 @@ function next_moment_time(m::MomentQueue)
   (isempty(m) ? Inf : m.last + delta_t(front(m)))
 end
 
+# The position, in the root queue, of each moment that increments the offset
+# counter, and the number of trials started before it. This allows `run` to
+# jump directly to the first offset that isn't skipped. Moments whose number of
+# offsets isn't known during setup (see `addtrials`) end the index.
+mutable struct OffsetIndex
+  positions::Vector{Int}
+  trials::Vector{Int}
+  n_trials::Int
+  stop::Int
+end
+OffsetIndex() = OffsetIndex(Int[],Int[],0,0)
+
+# All active queues of an experiment. The queues are kept in the order they were
+# added (which determines the order in which they receive events), and in a
+# binary min-heap ordered by their deadlines, so that the run loop only needs to
+# visit the queues that are actually due.
+#
+# Queues that become empty are kept in a pool, and reused for the moments of
+# later compound moments, so that running a compound moment (e.g. in each
+# iteration of an `@addtrials while` loop) doesn't allocate a new queue.
+mutable struct MomentQueues
+  queues::Vector{MomentQueue}
+  heap::Vector{MomentQueue}
+  due::Vector{MomentQueue}
+  pool::Vector{MomentQueue}
+  count::Int
+  offsets::OffsetIndex
+end
+function MomentQueues(q::MomentQueue)
+  q.order = 1
+  MomentQueues([q],MomentQueue[],MomentQueue[],MomentQueue[],1,OffsetIndex())
+end
+
+const max_pooled_queues = 32
+
+# an empty queue holds only empty moments, so it only needs its position and
+# deadline reset before it is reused
+function recycle!(qs::MomentQueues,q::MomentQueue)
+  @assert isempty(q)
+  if length(qs.pool) < max_pooled_queues
+    q.start_index = q.end_index = 1
+    q.very_first = true
+    q.heap_index = 0
+    q.deadline = Inf
+    q.order = 0
+    push!(qs.pool,q)
+  end
+  qs
+end
+
+# a queue of the given moments, taken from the pool when possible
+function pooled_queue!(qs::MomentQueues,xs,last::Float64)
+  isempty(qs.pool) && return MomentQueue(xs,last)
+
+  q = pop!(qs.pool)
+  reserve!(q,length(xs))
+  @inbounds for i in 1:length(xs)
+    q.data[i] = xs[i]
+  end
+  q.last = last
+  q.end_index = max(1,length(xs))
+  q
+end
+
+isempty(qs::MomentQueues) = isempty(qs.queues)
+length(qs::MomentQueues) = length(qs.queues)
+first(qs::MomentQueues) = first(qs.queues)
+getindex(qs::MomentQueues,i) = qs.queues[i]
+start(qs::MomentQueues) = start(qs.queues)
+done(qs::MomentQueues,i) = done(qs.queues,i)
+next(qs::MomentQueues,i) = next(qs.queues,i)
+show(io::IO,qs::MomentQueues) = write(io,"MomentQueues[$(join(qs.queues,","))]")
+
+next_deadline(qs::MomentQueues) = isempty(qs.heap) ? Inf : qs.heap[1].deadline
+
+function push!(qs::MomentQueues,q::MomentQueue)
+  push!(qs.queues,q)
+  q.order = (qs.count += 1)
+  push_deadline!(qs,q,next_moment_time(q))
+  qs
+end
+
+function push_deadline!(qs::MomentQueues,q::MomentQueue,deadline::Float64)
+  @assert q.heap_index == 0
+  q.deadline = deadline
+  push!(qs.heap,q)
+  q.heap_index = length(qs.heap)
+  heap_up!(qs.heap,q.heap_index)
+  qs
+end
+
+function pop_deadline!(qs::MomentQueues)
+  remove_deadline!(qs,qs.heap[1])
+end
+
+function remove_deadline!(qs::MomentQueues,q::MomentQueue)
+  heap = qs.heap
+  i = q.heap_index
+  last = pop!(heap)
+  if i <= length(heap)
+    heap[i] = last
+    last.heap_index = i
+    heap_down!(heap,heap_up!(heap,i))
+  end
+  q.heap_index = 0
+  q
+end
+
+function update_deadline!(qs::MomentQueues,q::MomentQueue,deadline::Float64)
+  if q.heap_index == 0
+    push_deadline!(qs,q,deadline)
+  else
+    q.deadline = deadline
+    heap_down!(qs.heap,heap_up!(qs.heap,q.heap_index))
+  end
+  qs
+end
+
+# queues due at the same time are handled in the order they were added
+@inline function heap_before(a::MomentQueue,b::MomentQueue)
+  a.deadline < b.deadline || (a.deadline == b.deadline && a.order < b.order)
+end
+
+function heap_swap!(heap,i,j)
+  heap[i], heap[j] = heap[j], heap[i]
+  heap[i].heap_index = i
+  heap[j].heap_index = j
+end
+
+function heap_up!(heap,i)
+  while i > 1
+    parent = i >> 1
+    heap_before(heap[i],heap[parent]) || break
+    heap_swap!(heap,i,parent)
+    i = parent
+  end
+  i
+end
+
+function heap_down!(heap,i)
+  n = length(heap)
+  while true
+    child = 2i
+    child > n && break
+    if child < n && heap_before(heap[child+1],heap[child])
+      child += 1
+    end
+    heap_before(heap[child],heap[i]) || break
+    heap_swap!(heap,i,child)
+    i = child
+  end
+  i
+end
+
 ################################################################################
 # experiment types
 
@@ -686,13 +997,33 @@ struct ExperimentInfo
   meta::Dict{Symbol,Any}
   input_resolution::Float64
   moment_resolution::Float64
+  scheduler::Symbol
+  spin_window::Float64
+  prepare_horizon::Float64
+  observer::Function
+  moment_traces::Symbol
   start::DateTime
   header::Array{Symbol}
   file::Nullable{String}
+  record_plan::RecordPlan
+  records::RecordBuffer
   hide_output::Bool
   warn_on_trials_only::Bool
 end
 
+# when garbage is collected during an experiment (see the `gc_policy` keyword
+# of `Experiment`), and the memory allocated since the last trial boundary
+mutable struct GCState
+  policy::Symbol
+  report::Bool
+  critical::Int
+  requested::Bool
+  disabled::Bool
+  bytes::Int64
+  time_ns::UInt64
+end
+GCState(policy,report) = GCState(policy,report,0,false,false,0,0)
+
 # ongoing state about an experiment that changes moment to moment
 mutable struct ExperimentData
   offset::Int
@@ -702,10 +1033,17 @@ mutable struct ExperimentData
   next_moment::Float64
   trial_watcher::Function
   pause_mode::Int
-  moments::Array{MomentQueue,1}
+  moments::MomentQueues
   streamers::Dict{Int,TimedSound.Streamer}
+  sound_streams::Dict{Int,SoundStream}
   last_good_delta::Float64
   last_bad_delta::Float64
+  wakeup::WakeupStats
+  gc::GCState
+  stats::RunStats
+  trace::MomentTrace
+  blocks::Stack{ExpandingMoment}
+  deferred::Vector{Function}
 end
 
 # flags to track experiment state
@@ -744,17 +1082,31 @@ data(e::ExtendedExperiment) = e.exp.data
 flags(e::ExtendedExperiment) = e.exp.flags
 win(e::ExtendedExperiment) = e.exp.win
 
+# The type of each layer of an extended experiment can be determined from the
+# type of any other layer, so `next` and `top` are generated functions: each
+# call compiles down to the construction of a concretely typed, immutable
+# wrapper, and can be inlined. A method that only forwards to `next(exp)`
+# therefore costs nothing once compiled.
+
 """
     extension(experiment::ExtendedExperiment)
 
 Get the extension object for this extended expeirment
 """
-extension{E,ES,N,W}(e::ExtendedExperiment{E,ES,N,W}) = e.extensions[N]
+@generated function extension{E,ES,N,W}(e::ExtendedExperiment{E,ES,N,W})
+  quote
+    Base.@_inline_meta
+    e.extensions[$N]
+  end
+end
 
-function top{E,ES <: Tuple,N,W}(e::ExtendedExperiment{E,ES,N,W})
+@generated function top{E,ES <: Tuple,N,W}(e::ExtendedExperiment{E,ES,N,W})
   E1 = ES.parameters[end]
-  N1 = length(e.extensions)
-  ExtendedExperiment{E1,ES,N1,W}(e.exp,e.extensions)
+  N1 = length(ES.parameters)
+  quote
+    Base.@_inline_meta
+    ExtendedExperiment{$E1,$ES,$N1,$W}(e.exp,e.extensions)
+  end
 end
 
 """
@@ -762,11 +1114,14 @@ end
 
 Get the next extended version of this experiment.
 """
-function next{E,ES,N,W}(e::ExtendedExperiment{E,ES,N,W})
+@generated function next{E,ES,N,W}(e::ExtendedExperiment{E,ES,N,W})
   E1 = ES.parameters[N-1]
-  ExtendedExperiment{E1,ES,N-1,W}(e.exp,e.extensions)
+  quote
+    Base.@_inline_meta
+    ExtendedExperiment{$E1,$ES,$(N-1),$W}(e.exp,e.extensions)
+  end
 end
-function next{E,ES,W}(e::ExtendedExperiment{E,ES,1,W})
+@inline function next{E,ES,W}(e::ExtendedExperiment{E,ES,1,W})
   BaseExtendedExperiment{W,typeof(top(e))}(top(e))
 end
 
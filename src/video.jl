@@ -7,13 +7,13 @@ using Lazy: @>>
 using LRUCache
 
 import Base: display, close, +, convert, promote_rule, convert, push!,
-  filter!, length, collect, copy
+  filter!, length, collect, copy, isready, empty!, resize!, get!
 
  # importing solely to allow their use in user code
 import Colors: @colorant_str, RGB
 
 export visual, window, font, display, close, @colorant_str, RGB,
-  clear_image_cache
+  clear_image_cache, prefetch
 
 @static if is_windows()
   const font_dirs = [".",joinpath(ENV["WINDIR"],"fonts")]
@@ -49,15 +49,20 @@ display_priority(x::RenderItem) = display_priority(x.r)
 display_duration(x::RenderItem) = display_duration(x.r)
 timed(x::RenderItem) = timed(x.r)
 
+# the items of the stack are kept in the order they are drawn: sorted by
+# priority, and, within the same priority, by the time they were added.
 mutable struct DisplayStack
-  data::OrderedSet{RenderItem}
+  data::Vector{RenderItem}
   next_change::Float64
 end
-DisplayStack() = DisplayStack(OrderedSet{RenderItem}(),Inf)
+DisplayStack() = DisplayStack(RenderItem[],Inf)
 
 function push!(x::DisplayStack,r::SDLRendered)
   item = RenderItem(r,(timed(r) ? Weber.tick() + display_duration(r) : Inf))
-  push!(x.data,item)
+  range = searchsorted(x.data,item,by=display_priority)
+  if item ∉ view(x.data,range)
+    insert!(x.data,last(range)+1,item)
+  end
   if timed(r)
     x.next_change = min(x.next_change,item.delete_at)
   end
@@ -78,9 +83,9 @@ function delete_expired!(stack::DisplayStack,tick=Weber.tick())
   next_change = Inf
   stack.data = filter!(stack.data) do item
     if item.delete_at + change_resolution <= tick
-      next_change = min(next_change,item.delete_at)
       false
     else
+      next_change = min(next_change,item.delete_at)
       true
     end
   end
@@ -93,12 +98,67 @@ collect(x::DisplayStack) = collect(x.data)
 copy(x::DisplayStack) = DisplayStack(copy(x.data),x.next_change)
 ischanging(x::DisplayStack,tick) = x.next_change + change_resolution <= tick
 
+immutable SDLRect
+  x::Cint
+  y::Cint
+  w::Cint
+  h::Cint
+end
+
+################################################################################
+# texture atlas
+#
+# Text and small images are packed into a few large textures (pages), so that
+# drawing a display with many visual objects does not switch textures between
+# each copy, and the renderer can submit consecutive copies as a single batch.
+# Objects are placed from left to right along horizontal shelves. Space isn't
+# reused within a page: a page is freed once it is full and none of its objects
+# remain in use. Large images get a texture of their own.
+
+const atlas_page_size = 2048
+const atlas_max_item = 512
+const atlas_padding = 1
+
+const SDL_PIXELFORMAT_ARGB8888 = 0x16362004
+const SDL_TEXTUREACCESS_STATIC = 0
+const SDL_TEXTUREACCESS_TARGET = 2
+const SDL_BLENDMODE_NONE = 0x00000000
+const SDL_BLENDMODE_BLEND = 0x00000001
+
+mutable struct AtlasPage
+  data::Ptr{Void}
+  w::Cint
+  h::Cint
+  x::Cint
+  y::Cint
+  shelf::Cint
+  live::Int
+  open::Bool
+end
+
+mutable struct TextureRegion
+  page::AtlasPage
+  src::SDLRect
+end
+
+mutable struct TextureAtlas
+  renderer::Ptr{Void}
+  pages::Vector{AtlasPage}
+  current::Nullable{AtlasPage}
+end
+TextureAtlas(renderer) = TextureAtlas(renderer,AtlasPage[],Nullable())
+
 abstract type ExperimentWindow end
+
+# an experiment without a window (i.e. `null_window=true`) stores the rows it
+# records in its window (see `simulate`)
 mutable struct NullWindow <: ExperimentWindow
   w::Cint
   h::Cint
   closed::Bool
+  records::Vector{Any}
 end
+NullWindow(w,h,closed) = NullWindow(w,h,closed,[])
 visual(win::NullWindow,args...;kwds...) = nothing
 display(win::NullWindow,r;kwds...) = nothing
 
@@ -109,6 +169,13 @@ mutable struct SDLWindow <: ExperimentWindow
   h::Cint
   closed::Bool
   stack::DisplayStack
+  atlas::TextureAtlas
+  frame_period::Float64
+  missed_frames::Int
+  frame::Ptr{Void}
+  drawn::Vector{SDLRendered}
+  saved::DisplayStack
+  presents::Int
 end
 
 const SDL_WINDOWPOS_CENTERED = 0x2fff0000
@@ -168,6 +235,7 @@ function window(width=1024,height=768;fullscreen=true,
 
   rend = ccall((:SDL_CreateRenderer,weber_SDL2),Ptr{Void},
                (Ptr{Void},Cint,UInt32),win,-1,(accel ? flags : fallback_flags))
+  vsync = accel && rend != C_NULL
   if rend == C_NULL
     accel_error = SDL_GetError()
     if accel
@@ -187,18 +255,62 @@ function window(width=1024,height=768;fullscreen=true,
         (Ptr{Void},Ptr{Cint},Ptr{Cint}),win,pointer(wh,1),pointer(wh,2))
   ccall((:SDL_ShowCursor,weber_SDL2),Void,(Cint,),0)
 
-  x = SDLWindow(win,rend,wh[1],wh[2],false,DisplayStack())
+  x = SDLWindow(win,rend,wh[1],wh[2],false,DisplayStack(),TextureAtlas(rend),
+                (vsync ? refresh_period(win) : 0.0),0,
+                frame_texture(rend,wh[1],wh[2]),SDLRendered[],DisplayStack(),0)
+  invalidate!(x)
   finalizer(x,x -> (x.closed ? nothing : close(x)))
 
   x
 end
 
+const refresh_rate_ptr = 0x000000000000000c # icxx"offsetof(SDL_DisplayMode,refresh_rate);"
+const default_refresh_rate = 60
+
+# the time between screen refreshes, in seconds
+function refresh_period(win::Ptr{Void})
+  mode = zeros(UInt8,64) # room for an SDL_DisplayMode
+  if ccall((:SDL_GetWindowDisplayMode,weber_SDL2),Cint,(Ptr{Void},Ptr{UInt8}),
+           win,mode) != 0
+    warn("Could not determine the display's refresh rate: "*SDL_GetError())
+    return 1/default_refresh_rate
+  end
+  rate = at(Ptr{Void}(pointer(mode)),Cint,refresh_rate_ptr)
+  1/(rate > 0 ? rate : default_refresh_rate)
+end
+frame_period(win::SDLWindow) = win.frame_period
+frame_period(win::NullWindow) = 0.0
+
+# the display is drawn to a texture that persists across frames, so that only
+# the parts of the display that change need to be redrawn. If the renderer
+# cannot render to a texture, the whole display is redrawn each frame.
+function frame_texture(renderer,w,h)
+  if !ccall((:SDL_RenderTargetSupported,weber_SDL2),Bool,(Ptr{Void},),renderer)
+    return C_NULL
+  end
+  texture = ccall((:SDL_CreateTexture,weber_SDL2),Ptr{Void},
+                  (Ptr{Void},UInt32,Cint,Cint,Cint),renderer,
+                  SDL_PIXELFORMAT_ARGB8888,SDL_TEXTUREACCESS_TARGET,w,h)
+  if texture == C_NULL
+    warn("Failed to create frame texture, falling back to redrawing the ",
+         "entire display: "*SDL_GetError())
+  else
+    ccall((:SDL_SetTextureBlendMode,weber_SDL2),Cint,(Ptr{Void},UInt32),
+          texture,SDL_BLENDMODE_NONE)
+  end
+  texture
+end
+
 """
     close(win::SDLWindow)
 
 Closes a visible SDLWindow window.
 """
 function close(win::SDLWindow)
+  forget_glyphs!(win)
+  forget_images!(win)
+  close(win.atlas)
+  win.frame = C_NULL
   ccall((:SDL_DestroyRenderer,weber_SDL2),Void,(Ptr{Void},),win.renderer)
   ccall((:SDL_DestroyWindow,weber_SDL2),Void,(Ptr{Void},),win.data)
   ccall((:SDL_ShowCursor,weber_SDL2),Void,(Cint,),1)
@@ -217,7 +329,10 @@ function clear(window::SDLWindow,color::RGB{N0f8}=colorant"gray")
         reinterpret(UInt8,red(color)),
         reinterpret(UInt8,green(color)),
         reinterpret(UInt8,blue(color)))
-  ccall((:SDL_RenderClear,weber_SDL2),Void,(Ptr{Void},),window.renderer)
+  # unlike SDL_RenderClear, filling respects the clipping rectangle, so that
+  # only the redrawn part of the display is cleared
+  ccall((:SDL_RenderFillRect,weber_SDL2),Cint,(Ptr{Void},Ptr{SDLRect}),
+        window.renderer,C_NULL)
   nothing
 end
 clear(win::NullWindow,color) = nothing
@@ -304,11 +419,107 @@ function visual(window::SDLWindow,color::Color;duration=0s,priority=0)
   SDLClear(color,ustrip(inseconds(duration)),priority)
 end
 
-immutable SDLRect
-  x::Cint
-  y::Cint
-  w::Cint
-  h::Cint
+################################################################################
+# texture atlas (see `TextureAtlas`)
+
+function create_texture(renderer,w,h)
+  texture = ccall((:SDL_CreateTexture,weber_SDL2),Ptr{Void},
+                  (Ptr{Void},UInt32,Cint,Cint,Cint),renderer,
+                  SDL_PIXELFORMAT_ARGB8888,SDL_TEXTUREACCESS_STATIC,w,h)
+  if texture == C_NULL
+    error("Failed to create texture: "*SDL_GetError())
+  end
+  ccall((:SDL_SetTextureBlendMode,weber_SDL2),Cint,(Ptr{Void},UInt32),
+        texture,SDL_BLENDMODE_BLEND)
+
+  texture
+end
+
+function new_page!(atlas::TextureAtlas,w,h,open)
+  page = AtlasPage(create_texture(atlas.renderer,w,h),w,h,0,0,0,0,open)
+  push!(atlas.pages,page)
+  page
+end
+
+function free_page!(atlas::TextureAtlas,page::AtlasPage)
+  if page.data != C_NULL
+    ccall((:SDL_DestroyTexture,weber_SDL2),Void,(Ptr{Void},),page.data)
+    page.data = C_NULL
+  end
+  filter!(p -> p !== page,atlas.pages)
+end
+
+function release!(atlas::TextureAtlas,region::TextureRegion)
+  page = region.page
+  page.live -= 1
+  if page.live == 0 && !page.open
+    free_page!(atlas,page)
+  end
+end
+
+function close(atlas::TextureAtlas)
+  for page in atlas.pages
+    # the renderer frees all of its textures
+    page.data = C_NULL
+  end
+  empty!(atlas.pages)
+  atlas.current = Nullable()
+end
+
+# find space for a w × h area in the current page, starting a new page if there
+# is no room left.
+function reserve!(atlas::TextureAtlas,w,h)
+  if !isnull(atlas.current)
+    page = get(atlas.current)
+    if page.x + w > page.w
+      page.x = 0
+      page.y += page.shelf + atlas_padding
+      page.shelf = 0
+    end
+
+    if page.y + h <= page.h
+      x,y = page.x,page.y
+      page.x += w + atlas_padding
+      page.shelf = max(page.shelf,h)
+      return page,x,y
+    end
+
+    page.open = false
+    page.live == 0 && free_page!(atlas,page)
+  end
+
+  atlas.current = Nullable(new_page!(atlas,atlas_page_size,atlas_page_size,true))
+  reserve!(atlas,w,h)
+end
+
+function add_texture!(atlas::TextureAtlas,surface::Ptr{Void})
+  w = at(surface,Cint,w_ptr)
+  h = at(surface,Cint,h_ptr)
+  if w > atlas_max_item || h > atlas_max_item
+    page = new_page!(atlas,w,h,false)
+    x = y = Cint(0)
+  else
+    page,x,y = reserve!(atlas,w,h)
+  end
+
+  converted = ccall((:SDL_ConvertSurfaceFormat,weber_SDL2),Ptr{Void},
+                    (Ptr{Void},UInt32,UInt32),surface,SDL_PIXELFORMAT_ARGB8888,0)
+  if converted == C_NULL
+    error("Failed to convert surface: "*SDL_GetError())
+  end
+  src = SDLRect(x,y,w,h)
+  err = ccall((:SDL_UpdateTexture,weber_SDL2),Cint,
+              (Ptr{Void},Ptr{SDLRect},Ptr{Void},Cint),page.data,Ref(src),
+              at(converted,Ptr{Void},pixels_ptr),at(converted,Cint,pitch_ptr))
+  ccall((:SDL_FreeSurface,weber_SDL2),Void,(Ptr{Void},),converted)
+  if err != 0
+    error("Failed to copy surface to texture: "*SDL_GetError())
+  end
+
+  page.live += 1
+  region = TextureRegion(page,src)
+  finalizer(region,x -> release!(atlas,x))
+  region
 end
 
 function as_screen_coordinates(window,x,y,w,h)
@@ -319,7 +530,7 @@ end
 function as_screen_coordinate_x(window,x,w)
   max(0,min(window.w,round(Cint,window.w/2 + x*window.w/4 - w / 2)))
 end
-function as_screen_coordinate_y(window,y,w)
+function as_screen_coordinate_y(window,y,h)
   max(0,min(window.h,round(Cint,window.h/2 - y*window.h/4 - h / 2)))
 end
 
@@ -332,6 +543,7 @@ function update_arguments(rect::SDLRect;w=NaN,h=NaN,x=NaN,y=NaN,kwds...)
       h = rect.h
     end
 
+    window = win(get_experiment())
     if !isnan(x)
       newx = as_screen_coordinate_x(window,x,w)
     else
@@ -344,7 +556,7 @@ function update_arguments(rect::SDLRect;w=NaN,h=NaN,x=NaN,y=NaN,kwds...)
       newy = rect.y
     end
 
-    SDLRect(x,y,w,h)
+    SDLRect(newx,newy,w,h)
   else
     rect
   end
@@ -354,15 +566,24 @@ end
 abstract type SDLTextured <: SDLSimpleRendered end
 
 function draw(window::SDLWindow,texture::SDLTextured)
+  region = data(texture)
   ccall((:SDL_RenderCopy,weber_SDL2),Void,
-        (Ptr{Void},Ptr{Void},Ptr{Void},Ptr{SDLRect}),
-        window.renderer,data(texture),C_NULL,Ref(rect(texture)))
+        (Ptr{Void},Ptr{Void},Ptr{SDLRect},Ptr{SDLRect}),
+        window.renderer,region.page.data,Ref(region.src),Ref(rect(texture)))
   nothing
 end
 
-mutable struct SDLText <: SDLTextured
+# the glyphs of a string, placed relative to the top left corner of the text
+struct TextLayout
+  regions::Vector{TextureRegion}
+  rects::Vector{SDLRect}
+  w::Cint
+  h::Cint
+end
+
+mutable struct SDLText <: SDLSimpleRendered
   str::String
-  data::Ptr{Void}
+  layout::TextLayout
   rect::SDLRect
   duration::Float64
   priority::Float64
@@ -370,8 +591,22 @@ mutable struct SDLText <: SDLTextured
 end
 display_duration(text::SDLText) = text.duration
 display_priority(text::SDLText) = text.priority
-data(text::SDLText) = text.data
 rect(text::SDLText) = text.rect
+screen_rect(window,text::SDLText) = text.rect
+
+# all glyphs use the same page of the atlas (unless it filled up), so the
+# renderer can submit these copies as a single batch.
+function draw(window::SDLWindow,text::SDLText)
+  layout = text.layout
+  for i in eachindex(layout.regions)
+    region,r = layout.regions[i],layout.rects[i]
+    dest = SDLRect(text.rect.x + r.x,text.rect.y + r.y,r.w,r.h)
+    ccall((:SDL_RenderCopy,weber_SDL2),Void,
+          (Ptr{Void},Ptr{Void},Ptr{SDLRect},Ptr{SDLRect}),
+          window.renderer,region.page.data,Ref(region.src),Ref(dest))
+  end
+  nothing
+end
 function update_arguments(text::SDLText;w=NaN,h=NaN,color=nothing,
                           duration=text.duration*s,priority=text.priority,
                           kwds...)
@@ -387,7 +622,8 @@ function update_arguments(text::SDLText;w=NaN,h=NaN,color=nothing,
   end
 
   rect = update_arguments(text.rect;kwds...)
-  SDLText(text.str,text.data,rect,ustrip(inseconds(duration)),priority,text.color)
+  SDLText(text.str,text.layout,rect,ustrip(inseconds(duration)),priority,
+          text.color)
 end
 
 fonts = Dict{Tuple{String,Int},SDLFont}()
@@ -444,10 +680,14 @@ argument can specify a font, loaded using the `font` function.
   before wrapping.
 * clean_whitespace: if true, replace all consecutive white space with a single
   space.
+
+Text is drawn from glyphs that are rendered once per font and color, so
+rendering a new string (e.g. to show a running score) is fast. Strings should
+still be rendered before they are displayed.
 """
 function visual(window::SDLWindow,str::String,cache=true;keys...)
   if isimage(str)
-    image_cache(cache,str) do
+    image_cache(cache,window,str,keys) do
       visual(window,load(str),false;keys...)
     end
   else
@@ -485,42 +725,183 @@ end
 
 const w_ptr = 0x0000000000000010 # icxx"offsetof(SDL_Surface,w);"
 const h_ptr = 0x0000000000000014 # icxx"offsetof(SDL_Surface,h);"
+const pitch_ptr = 0x0000000000000018 # icxx"offsetof(SDL_Surface,pitch);"
+const pixels_ptr = 0x0000000000000020 # icxx"offsetof(SDL_Surface,pixels);"
+
+################################################################################
+# text rendering
+#
+# Text is drawn glyph by glyph. Each glyph is rendered once, for a given font,
+# color and window, and stored in the texture atlas of the window. The layout
+# of a string only places these cached glyphs, so that new strings (e.g. a
+# running score or "Trial 37 of 400") don't need a new surface or texture. The
+# layout of recently used strings is cached too. Strings with characters
+# outside of the basic multilingual plane, which SDL_ttf can't render as
+# glyphs, are rendered as a whole instead.
+
+struct Glyph
+  region::Nullable{TextureRegion}
+  offset::Cint # horizontal offset of the glyph's image from the pen position
+  advance::Cint
+end
+
+mutable struct GlyphCache
+  font::SDLFont
+  color::RGB{N0f8}
+  height::Cint
+  line_skip::Cint
+  glyphs::Dict{Char,Glyph}
+end
 
-const text_cache = LRU{Tuple{String,UInt32,SDLFont},SDLText}(256)
+# the caches are shared by all experiments, and are keyed by the loaded font
+# (i.e. its name and size), the color of the text, and the renderer of the
+# window whose atlas stores the glyphs.
+const glyph_caches = Dict{Tuple{Ptr{Void},RGB{N0f8},Ptr{Void}},GlyphCache}()
+const text_cache = LRU{Tuple{String,UInt32,GlyphCache},TextLayout}(256)
+const text_cache_lock = ReentrantLock()
+
+function glyph_cache(window::SDLWindow,font::SDLFont,color::RGB{N0f8})
+  get!(glyph_caches,(font.data,color,window.renderer)) do
+    height = ccall((:TTF_FontHeight,weber_SDL2_ttf),Cint,(Ptr{Void},),font.data)
+    line_skip = ccall((:TTF_FontLineSkip,weber_SDL2_ttf),Cint,(Ptr{Void},),
+                      font.data)
+    GlyphCache(font,color,height,line_skip,Dict{Char,Glyph}())
+  end
+end
 
-function visual(window::SDLWindow,x::Real,y::Real,font::SDLFont,color::RGB{N0f8},
-                wrap_width::UInt32,str::String,duration=0s,priority=0)
-  get!(text_cache,(str,wrap_width,font)) do
-    surface = ccall((:TTF_RenderUTF8_Blended_Wrapped,weber_SDL2_ttf),Ptr{Void},
-                    (Ptr{Void},Cstring,RGBA{N0f8},UInt32),
-                    font.data,pointer(str),color,wrap_width)
-    if surface == C_NULL
-      error("Failed to render text: "*TTF_GetError())
+function forget_glyphs!(window::SDLWindow)
+  with_lock(text_cache_lock) do
+    filter!((key,cache) -> key[3] != window.renderer,glyph_caches)
+  end
+end
+
+function render_text(window::SDLWindow,font::SDLFont,color::RGB{N0f8},
+                     str::String,wrap_width=nothing)
+  surface = if wrap_width == nothing
+    ccall((:TTF_RenderUTF8_Blended,weber_SDL2_ttf),Ptr{Void},
+          (Ptr{Void},Cstring,RGBA{N0f8}),font.data,pointer(str),color)
+  else
+    ccall((:TTF_RenderUTF8_Blended_Wrapped,weber_SDL2_ttf),Ptr{Void},
+          (Ptr{Void},Cstring,RGBA{N0f8},UInt32),
+          font.data,pointer(str),color,wrap_width)
+  end
+  if surface == C_NULL
+    error("Failed to render text: "*TTF_GetError())
+  end
+
+  region = add_texture!(window.atlas,surface)
+  ccall((:SDL_FreeSurface,weber_SDL2),Void,(Ptr{Void},),surface)
+  region
+end
+
+function glyph!(window::SDLWindow,cache::GlyphCache,c::Char)
+  get!(cache.glyphs,c) do
+    minx,maxx,miny,maxy,advance = (Ref{Cint}(0) for i in 1:5)
+    err = ccall((:TTF_GlyphMetrics,weber_SDL2_ttf),Cint,
+                (Ptr{Void},UInt16,Ref{Cint},Ref{Cint},Ref{Cint},Ref{Cint},
+                 Ref{Cint}),cache.font.data,UInt16(c),
+                minx,maxx,miny,maxy,advance)
+    if err != 0
+      error("Failed to find the metrics of glyph '$c': "*TTF_GetError())
     end
 
-    texture = ccall((:SDL_CreateTextureFromSurface,weber_SDL2),Ptr{Void},
-                    (Ptr{Void},Ptr{Void}),window.renderer,surface)
-    if texture == C_NULL
-      error("Failed to create texture for render text: "*SDL_GetError())
+    if isspace(c)
+      Glyph(Nullable(),0,advance[])
+    else
+      # a glyph that extends left of the pen is shifted right when rendered
+      region = render_text(window,cache.font,cache.color,string(c))
+      Glyph(Nullable(region),min(0,minx[]),advance[])
     end
+  end
+end
 
-    w = at(surface,Cint,w_ptr)
-    h = at(surface,Cint,h_ptr)
+kerning(cache::GlyphCache,prev::Char,c::Char) =
+  ccall((:TTF_GetFontKerningSizeGlyphs,weber_SDL2_ttf),Cint,
+        (Ptr{Void},UInt16,UInt16),cache.font.data,UInt16(prev),UInt16(c))
+
+function text_width(window::SDLWindow,cache::GlyphCache,str::AbstractString)
+  x = 0
+  prev = Nullable{Char}()
+  for c in str
+    isnull(prev) || (x += kerning(cache,get(prev),c))
+    x += glyph!(window,cache,c).advance
+    prev = Nullable(c)
+  end
+  x
+end
 
-    xint,yint = as_screen_coordinates(window,x,y,w,h)
+# breaks a string into lines no wider than `wrap_width` (when possible), at
+# spaces and newlines, like `TTF_RenderUTF8_Blended_Wrapped`. A `wrap_width` of
+# zero only breaks lines at newlines.
+function wrap_lines(width,str::AbstractString,wrap_width)
+  lines = String[]
+  for paragraph in split(str,'\n')
+    line = ""
+    for (i,word) in enumerate(split(paragraph,' '))
+      if i == 1
+        line = word
+      elseif wrap_width > 0 && width(line*" "*word) > wrap_width
+        push!(lines,line)
+        line = word
+      else
+        line = line*" "*word
+      end
+    end
+    push!(lines,line)
+  end
+  lines
+end
 
-    result = SDLText(str,texture,SDLRect(xint,yint,w,h),
-                     ustrip(inseconds(duration)),priority,color)
-    finalizer(result,x ->
-              ccall((:SDL_DestroyTexture,weber_SDL2),Void,(Ptr{Void},),x.data))
-    ccall((:SDL_FreeSurface,weber_SDL2),Void,(Ptr{Void},),surface)
+function text_layout(window::SDLWindow,cache::GlyphCache,str::String,
+                     wrap_width::UInt32)
+  if any(c -> UInt32(c) > 0xffff,str)
+    region = render_text(window,cache.font,cache.color,str,wrap_width)
+    return TextLayout([region],[SDLRect(0,0,region.src.w,region.src.h)],
+                      region.src.w,region.src.h)
+  end
 
-    result
+  regions = TextureRegion[]
+  rects = SDLRect[]
+  w = 0
+  lines = wrap_lines(line -> text_width(window,cache,line),str,wrap_width)
+  for (i,line) in enumerate(lines)
+    y = (i-1)*cache.line_skip
+    x = 0
+    prev = Nullable{Char}()
+    for c in line
+      isnull(prev) || (x += kerning(cache,get(prev),c))
+      glyph = glyph!(window,cache,c)
+      if !isnull(glyph.region)
+        src = get(glyph.region).src
+        push!(regions,get(glyph.region))
+        push!(rects,SDLRect(x + glyph.offset,y,src.w,src.h))
+        w = max(w,x + glyph.offset + src.w)
+      end
+      x += glyph.advance
+      prev = Nullable(c)
+    end
+    w = max(w,x)
+  end
+
+  TextLayout(regions,rects,w,(length(lines)-1)*cache.line_skip + cache.height)
+end
+
+function visual(window::SDLWindow,x::Real,y::Real,font::SDLFont,color::RGB{N0f8},
+                wrap_width::UInt32,str::String,duration=0s,priority=0)
+  layout = with_lock(text_cache_lock) do
+    cache = glyph_cache(window,font,color)
+    get!(text_cache,(str,wrap_width,cache)) do
+      text_layout(window,cache,str,wrap_width)
+    end
   end
+
+  xint,yint = as_screen_coordinates(window,x,y,layout.w,layout.h)
+  SDLText(str,layout,SDLRect(xint,yint,layout.w,layout.h),
+          ustrip(inseconds(duration)),priority,color)
 end
 
 mutable struct SDLImage <: SDLTextured
-  data::Ptr{Void}
+  data::TextureRegion
   img::Array{RGBA{N0f8}}
   rect::SDLRect
   duration::Float64
@@ -541,25 +922,124 @@ function update_arguments(img::SDLImage;w=NaN,h=NaN,duration=img.duration*s,
   SDLImage(img.data,img.img,rect,ustrip(inseconds(duration)),priority)
 end
 
-const convert_cache = LRU{UInt,Array{RGBA{N0f8}}}(256)
-const _image_cache = LRU{UInt,SDLImage}(256)
+# Images are cached by their content (or for files, their path and
+# modification time), the window they are displayed in and the arguments
+# passed to `visual`. The cache is bounded by the memory used by the cached
+# images, counting both the image in host memory and its texture. A single
+# cache is shared by all experiments, guarded by a lock.
+mutable struct ImageCache
+  data::OrderedDict{Any,SDLRendered}
+  bytes::Int
+  max_bytes::Int
+  hits::Int
+  misses::Int
+  evictions::Int
+  lock::ReentrantLock
+end
+ImageCache(max_bytes) = ImageCache(OrderedDict{Any,SDLRendered}(),0,max_bytes,
+                                   0,0,0,ReentrantLock())
+
+function Base.show(io::IO,cache::ImageCache)
+  write(io,"ImageCache($(length(cache.data)) images, "*
+        "$(cache.bytes) of $(cache.max_bytes) bytes, $(cache.hits) hits, "*
+        "$(cache.misses) misses, $(cache.evictions) evictions)")
+end
+
+const default_image_cache_bytes = 2^29
+const _image_cache = ImageCache(default_image_cache_bytes)
+
+"""
+    Weber.image_cache_stats()
+
+Returns the state of the image cache: the number of bytes used, the maximum
+number of bytes allowed (see [`resize_cache!`](@ref)), and the number of
+hits, misses and evictions since the cache was last cleared.
+"""
+image_cache_stats() = _image_cache
+
+cache_bytes(img::SDLImage) = sizeof(img.img) + 4Int(img.rect.w)*Int(img.rect.h)
+cache_bytes(r::SDLRendered) = 0
+
+function empty!(cache::ImageCache)
+  with_lock(cache.lock) do
+    empty!(cache.data)
+    cache.bytes = cache.hits = cache.misses = cache.evictions = 0
+  end
+  cache
+end
+
+function resize!(cache::ImageCache,max_bytes)
+  with_lock(cache.lock) do
+    cache.max_bytes = max_bytes
+    evict!(cache)
+  end
+end
+
+function evict!(cache::ImageCache)
+  while cache.bytes > cache.max_bytes && length(cache.data) > 1
+    key = first(keys(cache.data))
+    cache.bytes -= cache_bytes(pop!(cache.data,key))
+    cache.evictions += 1
+  end
+  cache
+end
+
+get!(fn::Function,cache::ImageCache,key) =
+  with_lock(() -> locked_get!(fn,cache,key),cache.lock)
+
+function locked_get!(fn::Function,cache::ImageCache,key)
+  if haskey(cache.data,key)
+    cache.hits += 1
+    # move the image to the back of the queue of images to evict
+    cache.data[key] = pop!(cache.data,key)
+  else
+    cache.misses += 1
+    result = fn()
+    cache.data[key] = result
+    cache.bytes += cache_bytes(result)
+    evict!(cache)
+    result
+  end
+end
 
 function clear_image_cache()
-  empty!(convert_cache)
-  empty!(_imge_cache)
+  empty!(_image_cache)
 end
 
-function image_cache(fn,usecache,x)
-  if usecache
-    get!(fn,_image_cache,object_id(x))
+image_key(x::String,keys) = (abspath(x),mtime(x),keys...)
+image_key(x::Array,keys) = (content_hash(x),keys...)
+
+function content_hash(x::Array)
+  h = hash(size(x),hash(eltype(x)))
+  if isbits(eltype(x))
+    h + ccall(:memhash_seed,UInt64,(Ptr{Void},Csize_t,UInt32),
+              x,sizeof(x),h % UInt32)
   else
-    fn()
+    hash(x,h)
+  end
+end
+
+function in_image_cache(window,x,keys)
+  with_lock(() -> haskey(_image_cache.data,window_key(window,x,keys)),
+            _image_cache.lock)
+end
+window_key(window,x,keys) = (window.renderer,image_key(x,keys))
+
+# drops the images cached for a window, as their textures are destroyed along
+# with its renderer (see `close`)
+function forget_images!(window::SDLWindow)
+  with_lock(_image_cache.lock) do
+    for key in collect(keys(_image_cache.data))
+      if key[1] == window.renderer
+        _image_cache.bytes -= cache_bytes(pop!(_image_cache.data,key))
+      end
+    end
   end
 end
 
-function image_cache(fn,usecache::Union{File,String},x)
+function image_cache(fn,usecache,window,x,keys)
   if usecache
-    get!(fn,_image_cache,x)
+    get!(fn,_image_cache,window_key(window,x,keys))
   else
     fn()
   end
@@ -577,56 +1057,50 @@ interpreted as gray scale images, and real-number 3d arrays as an RGB image or
 RGBA image, depending on whether size(img,1) is of size 3 or 4. A 3d array with
 a size(img,1) ∉ [3,4] results in an error.
 """
-function visual(window::SDLWindow,img::Array{<:AbstractFloat},cache=true;keys...)
-  image_cache(cache,img) do
-    converted = if length(size(img)) == 3
-      if size(img,1) == 3
-        n0f8.(colorview(RGB,img))
-      elseif size(img,1) == 4
-        n0f8.(colorview(RGBA,img))
-      else
-        error("Could not interpret array of size $(size(imge)) as a color image.")
-      end
-    elseif length(size(img)) == 2
-      n0f8.(colorview(Gray,img))
-    end
-    visual(window,converted,false;keys...)
+function visual(window::SDLWindow,img::Array,cache=true;keys...)
+  image_cache(cache,window,img,keys) do
+    visual(window,rgba_image(img),false;keys...)
   end
 end
 
-function visual(window::SDLWindow,img::Array,cache=true;keys...)
-  image_cache(cache,img) do
-    visual(window,convert(RGBA,n0f8.(img)),false;keys...)
+# convert an image to the format copied to textures
+function rgba_image(img::Array{<:AbstractFloat})
+  converted = if length(size(img)) == 3
+    if size(img,1) == 3
+      n0f8.(colorview(RGB,img))
+    elseif size(img,1) == 4
+      n0f8.(colorview(RGBA,img))
+    else
+      error("Could not interpret array of size $(size(img)) as a color image.")
+    end
+  elseif length(size(img)) == 2
+    n0f8.(colorview(Gray,img))
   end
+  rgba_image(converted)
 end
+rgba_image(img::Array) = convert(RGBA,n0f8.(img))
+rgba_image(img::Array{RGBA{N0f8}}) = img
 
 function visual(window::SDLWindow,img::Array{RGBA{N0f8}},cache=true;
                 x=0,y=0,duration=0s,priority=0)
-  image_cache(cache,img) do
+  image_cache(cache,window,img,(x,y,duration,priority)) do
+    pixels = copy(img')
     surface = ccall((:SDL_CreateRGBSurfaceFrom,weber_SDL2),Ptr{Void},
                     (Ptr{Void},Cint,Cint,Cint,Cint,UInt32,UInt32,UInt32,UInt32),
-                    pointer(copy(img')),size(img,2),size(img,1),32,
+                    pointer(pixels),size(img,2),size(img,1),32,
                     4size(img,2),0x000000ff,0x0000ff00,0x00ff0000,0xff000000)
     if surface == C_NULL
       error("Failed to create image surface: "*SDL_GetError())
     end
 
-    texture = ccall((:SDL_CreateTextureFromSurface,weber_SDL2),Ptr{Void},
-                    (Ptr{Void},Ptr{Void}),window.renderer,surface)
-    if texture == C_NULL
-      error("Failed to create texture from image surface: "*SDL_GetError())
-    end
+    region = add_texture!(window.atlas,surface)
+    ccall((:SDL_FreeSurface,weber_SDL2),Void,(Ptr{Void},),surface)
 
     h,w = size(img)
     xint,yint = as_screen_coordinates(window,x,y,w,h)
 
-    result = SDLImage(texture,img,SDLRect(xint,yint,w,h),
-                      ustrip(inseconds(duration)),priority)
-    finalizer(result,x ->
-              ccall((:SDL_DestroyTexture,weber_SDL2),Void,(Ptr{Void},),x.data))
-    ccall((:SDL_FreeSurface,weber_SDL2),Void,(Ptr{Void},),surface)
-
-    result
+    SDLImage(region,img,SDLRect(xint,yint,w,h),
+             ustrip(inseconds(duration)),priority)
   end
 end
 
@@ -711,11 +1185,22 @@ end
 =#
 
 function show_drawn(window::SDLWindow)
+  started = precise_time()
   ccall((:SDL_RenderPresent,weber_SDL2),Void,(Ptr{Void},),window.renderer)
+  observe_present!(precise_time() - started)
+  window.presents += 1
   nothing
 end
 show_drawn(win::NullWindow) = nothing
 
+# the number of frames presented by a window, used to determine if displaying
+# a visual changed the display (the null window stands in for a display that
+# always does).
+presents(window::SDLWindow) = window.presents
+presents(window::NullWindow) = 0
+presented_since(window::SDLWindow,n) = window.presents > n
+presented_since(window::NullWindow,n) = true
+
 const SDL_INIT_VIDEO = 0x00000020
 function setup_display()
   init = ccall((:SDL_Init,weber_SDL2),Cint,(UInt32,),SDL_INIT_VIDEO)
@@ -824,14 +1309,88 @@ function update_stack_helper!(window,r::SDLRendered)
   push!(window.stack,r)
 end
 
+# the area of the screen covered by a visual, used to determine which parts of
+# the display need to be redrawn
+screen_rect(window,r::SDLTextured) = rect(r)
+screen_rect(window,r::SDLRendered) = SDLRect(0,0,window.w,window.h)
+
+overlaps(a::SDLRect,b::SDLRect) =
+  a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h
+function bounds(a::SDLRect,b::SDLRect)
+  x,y = min(a.x,b.x),min(a.y,b.y)
+  SDLRect(x,y,max(a.x+a.w,b.x+b.w)-x,max(a.y+a.h,b.y+b.h)-y)
+end
+
+# beyond this many separate areas, the display is redrawn within their bounds
+const max_damaged_rects = 8
+
+# the areas of the display that differ between the visuals drawn during the
+# last frame and the visuals to draw now
+function damaged_rects(window,drawn,visuals)
+  rects = SDLRect[]
+  for r in drawn
+    r ∉ visuals && push!(rects,screen_rect(window,r))
+  end
+  for r in visuals
+    r ∉ drawn && push!(rects,screen_rect(window,r))
+  end
+
+  if isempty(rects) && drawn != visuals
+    # the same visuals, drawn in a different order
+    push!(rects,SDLRect(0,0,window.w,window.h))
+  elseif length(rects) > max_damaged_rects
+    rects = [reduce(bounds,rects)]
+  end
+  rects
+end
+
+set_clip(window::SDLWindow,rect::SDLRect) =
+  ccall((:SDL_RenderSetClipRect,weber_SDL2),Cint,(Ptr{Void},Ptr{SDLRect}),
+        window.renderer,Ref(rect))
+clear_clip(window::SDLWindow) =
+  ccall((:SDL_RenderSetClipRect,weber_SDL2),Cint,(Ptr{Void},Ptr{SDLRect}),
+        window.renderer,C_NULL)
+set_target(window::SDLWindow,texture::Ptr{Void}) =
+  ccall((:SDL_SetRenderTarget,weber_SDL2),Cint,(Ptr{Void},Ptr{Void}),
+        window.renderer,texture)
+
+# redraws the display, but only if some visual has changed since the last
+# frame. With a frame texture, only the areas that changed are redrawn.
 function draw_stack(window::SDLWindow)
-  clear(window)
-  for item in sort(collect(window.stack),by=display_priority,alg=MergeSort)
-    draw(window,item.r)
+  visuals = map(item -> item.r,window.stack.data)
+  visuals == window.drawn && return nothing
+
+  if window.frame == C_NULL
+    clear(window)
+    foreach(r -> draw(window,r),visuals)
+  else
+    set_target(window,window.frame)
+    for rect in damaged_rects(window,window.drawn,visuals)
+      set_clip(window,rect)
+      clear(window)
+      for r in visuals
+        overlaps(rect,screen_rect(window,r)) && draw(window,r)
+      end
+    end
+    clear_clip(window)
+    set_target(window,C_NULL)
+    ccall((:SDL_RenderCopy,weber_SDL2),Cint,
+          (Ptr{Void},Ptr{Void},Ptr{SDLRect},Ptr{SDLRect}),
+          window.renderer,window.frame,C_NULL,C_NULL)
   end
+
+  window.drawn = visuals
   show_drawn(window)
 end
 
+# forces the entire display to be redrawn, e.g. after the contents of the
+# frame texture have been lost.
+function invalidate!(window::SDLWindow)
+  window.drawn = SDLRendered[SDLClear(colorant"gray",0.0,-Inf)]
+  window
+end
+invalidate!(window::NullWindow) = window
+
 function refresh_display(window::SDLWindow,tick=Weber.tick())
   if ischanging(window.stack,tick)
     window.stack = delete_expired!(window.stack,tick)
@@ -841,6 +1400,9 @@ end
 
 refresh_display(window::NullWindow) = nothing
 
+next_display_change(window::SDLWindow) = window.stack.next_change
+next_display_change(window::NullWindow) = Inf
+
 struct SDLCompound <: SDLRendered
   data::Array{SDLRendered}
 end
@@ -883,19 +1445,139 @@ function update_stack_helper!(window,restore::RestoreDisplay)
   window.stack = delete_timed!(restore.x)
 end
 
-const saved_display = Array{DisplayStack}()
-saved_display[] = DisplayStack()
 function save_display(window::SDLWindow)
-  saved_display[] = copy(window.stack)
+  window.saved = copy(window.stack)
 end
 save_display(win::NullWindow) = nothing
 
 function restore_display(window::SDLWindow)
-  update_stack!(window,RestoreDisplay(saved_display[]))
+  update_stack!(window,RestoreDisplay(window.saved))
 end
 restore_display(win::NullWindow) = nothing
 
 function focus(window::SDLWindow)
   ccall((:SDL_RaiseWindow,weber_SDL2),Void,(Ptr{Void},),window.data)
+  invalidate!(window)
+  draw_stack(window)
 end
 focus(win::NullWindow) = nothing
+
+################################################################################
+# prefetching
+#
+# Visuals are prepared in two steps, both run as deferred jobs during the idle
+# time of the experiment: first images are loaded and converted, then they (or
+# text) are rendered to a texture.
+
+mutable struct VisualJob
+  window::SDLWindow
+  source::Any
+  keys::Vector{Any}
+  data::Any
+  stage::Int
+  result::Nullable{SDLRendered}
+end
+
+const job_queued = 0
+const job_decoded = 1
+const job_ready = 2
+
+mutable struct Prefetched <: SDLSimpleRendered
+  job::VisualJob
+  keys::Vector{Any}
+  result::Nullable{SDLRendered}
+end
+Prefetched(job) = Prefetched(job,[],Nullable())
+
+"""
+    prefetch(x;keys...)
+    prefetch(xs...;keys...)
+
+Prepare one or more objects to be displayed, like [`visual`](@ref), but do the
+work needed to load, convert and render each object during the idle time of a
+running experiment, rather than immediately. The returned objects can be passed
+to `display` (or a display moment) just like the result of `visual`. Any
+keyword arguments are passed to `visual`.
+
+Use `isready` to determine if a prefetched object has been fully prepared.  A
+prefetched object that isn't ready when the `display` moment it belongs to is
+prepared (see [`Weber.prepare!`](@ref)) is finished at that point, and a
+"visual_not_ready" code is recorded.
+"""
+prefetch(xs...;keys...) = prefetch(win(get_experiment()),xs...;keys...)
+function prefetch(window::SDLWindow,x;keys...)
+  job = VisualJob(window,x,collect(Any,keys),nothing,job_queued,Nullable())
+  # outside of an experiment, the job is finished when the visual is needed
+  in_experiment() && defer(() -> advance!(job))
+  Prefetched(job)
+end
+function prefetch(window::SDLWindow,x,y,xs...;keys...)
+  map(x -> prefetch(window,x;keys...),(x,y,xs...))
+end
+prefetch(window::NullWindow,xs...;keys...) = visual(window,xs...;keys...)
+
+isready(p::Prefetched) = p.job.stage == job_ready
+
+function decode(job,x::String)
+  isimage(x) && !in_image_cache(job.window,x,job.keys) ? rgba_image(load(x)) : x
+end
+decode(job,x::Array) = rgba_image(x)
+decode(job,x) = x
+
+render(job,x::Array) = visual(job.window,job.data,false;job.keys...)
+render(job,x) = visual(job.window,x;job.keys...)
+function render(job,x::String)
+  if isimage(x)
+    image_cache(true,job.window,x,job.keys) do
+      visual(job.window,job.data,false;job.keys...)
+    end
+  else
+    visual(job.window,x;job.keys...)
+  end
+end
+
+# run the next step of the job, returning true once the job is done
+function advance!(job::VisualJob)
+  if job.stage == job_queued
+    job.data = decode(job,job.source)
+    job.stage = job_decoded
+    false
+  elseif job.stage == job_decoded
+    job.result = Nullable(render(job,job.source))
+    job.data = nothing
+    job.stage = job_ready
+    true
+  else
+    true
+  end
+end
+
+function finish!(job::VisualJob)
+  while !advance!(job) end
+  job
+end
+
+function resolve(p::Prefetched)
+  if isnull(p.result)
+    r = get(finish!(p.job).result)
+    p.result = Nullable(isempty(p.keys) ? r : update_arguments(r;p.keys...))
+  end
+  get(p.result)
+end
+
+function update_arguments(p::Prefetched;kwds...)
+  Prefetched(p.job,[p.keys...,kwds...],Nullable())
+end
+display_duration(p::Prefetched) = display_duration(resolve(p))
+display_priority(p::Prefetched) = display_priority(resolve(p))
+draw(window::SDLWindow,p::Prefetched) = draw(window,resolve(p))
+screen_rect(window,p::Prefetched) = screen_rect(window,resolve(p))
+
+prepare_visual!(r) = nothing
+prepare_visual!(rs::SDLCompound) = foreach(prepare_visual!,rs.data)
+function prepare_visual!(p::Prefetched)
+  if !isready(p)
+    in_experiment() && record("visual_not_ready")
+    resolve(p)
+  end
+end
@@ -10,9 +10,22 @@ using Base.Iterators
     include("test_moment_preparation.jl")
     include("test_moment_looping.jl")
     include("test_moment_conditions.jl")
+    include("test_trial_source.jl")
   end
   include("test_record_columns.jl")
+  include("test_binary_data.jl")
+  include("test_gc_policy.jl")
+  include("test_image_cache.jl")
+  include("test_display_changes.jl")
+  include("test_text_layout.jl")
+  include("test_event_times.jl")
+  include("test_sound_stream.jl")
+  include("test_run_stats.jl")
   include("test_moment_checks.jl")
+  include("test_moment_traces.jl")
   include("test_extensions.jl")
   include("test_oddball.jl")
+  include("test_bayesian_adapter.jl")
+  include("test_simulation.jl")
+  include("test_experiment_contexts.jl")
 end
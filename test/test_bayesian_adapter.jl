@@ -0,0 +1,66 @@
+using Weber
+using Base.Test
+using Distributions
+
+srand(1983)
+adapter = bayesian_adapter(n_samples=200)
+for correct in [true,true,false,true]
+  update!(adapter,correct ? 1 : 2,1)
+end
+thresh,weights = Weber.sample(adapter)
+
+entropies = -sum(1:adapter.n_samples) do i
+  diff = thresh[i] .- adapter.theta_samples
+  dprime = exp.(diff./adapter.inv_slope_samples)/sqrt(2)
+  p = ((adapter.miss/2) + (1-adapter.miss)*cdf.(Normal(),dprime))
+  (p .* log.(p) + (1-p) .* log.(1-p)) .* weights
+end
+
+serial = copy(Weber.entropies!(adapter))
+adapter.threaded = true
+threaded = copy(Weber.entropies!(adapter))
+
+@testset "Bayesian Adapter" begin
+  @test length(thresh) == 200
+  @test sum(weights) ≈ 1
+  @test serial ≈ entropies
+  @test threaded ≈ entropies
+  @test 0 < delta(adapter) < 1
+end
+
+incremental = bayesian_adapter(n_samples=200,incremental=true,n_candidates=20)
+for i in 1:30
+  update!(incremental,1,1)
+end
+incremental_thresh,incremental_weights = Weber.sample(incremental)
+
+@testset "Incremental Bayesian Adapter" begin
+  @test length(incremental.entropies) == 20
+  @test incremental.candidates[[1,end]] == [1,200]
+  @test sum(incremental_weights) ≈ 1
+  @test Weber.ess(incremental_weights) >=
+    incremental.ess_threshold*incremental.n_samples
+  @test all(isfinite,incremental_thresh)
+  @test 0 < delta(incremental) < 1
+end
+
+tracks = interleaved_adapter(levitt_adapter(first_delta=0.1,down=1),
+                             levitt_adapter(first_delta=0.5,down=1))
+track_deltas = Float64[]
+track_order = Int[]
+for i in 1:4
+  push!(track_order,current_track(tracks))
+  push!(track_deltas,delta(tracks))
+  update!(tracks,1,1)
+end
+track_means,track_errors = estimate(tracks)
+
+@testset "Interleaved Adapters" begin
+  @test track_order == [1,2,1,2]
+  @test track_deltas ≈ [0.1,0.5,0.09,0.49]
+  @test estimate(tracks) isa Tuple
+  @test length(track_means) == length(track_errors) == 2
+  @test Weber.response_columns(tracks) == (:track,)
+  @test Weber.response_values(tracks) == (:track => 1,)
+  @test_throws ErrorException interleaved_adapter(levitt_adapter(),order=:best)
+end
@@ -0,0 +1,47 @@
+using Weber
+using Base.Test
+
+const binary_columns = [:code,:time,:trial,:value]
+binary_file = tempname()*".wlog"
+open(binary_file,"w") do io
+  format = Weber.BinaryFormat()
+  Weber.write_header(io,format,binary_columns)
+  Weber.write_row(io,format,Any["a",0.1234567890123,1,""])
+  Weber.write_row(io,format,Any[:b,1e-7,2,true])
+  Weber.write_row(io,format,Any["c",typemax(UInt64),Int128(2)^70,0x01])
+end
+binary_columns_read,binary_rows = read_binary_data(binary_file)
+binary_csv = readlines(binary_to_csv(binary_file))
+
+# simulate an experiment that crashed while writing a row
+open(binary_file,"a") do io
+  write(io,UInt32(100),0x01)
+end
+_,truncated_rows = read_binary_data(binary_file)
+
+@testset "Binary Data" begin
+  @test binary_columns_read == binary_columns
+  @test binary_rows[1] == ["a",0.1234567890123,1,""]
+  @test binary_rows[2] == [:b,1e-7,2,true]
+  @test binary_csv[1] == "code,time,trial,value"
+  @test binary_rows[3] == ["c",typemax(UInt64),string(Int128(2)^70),0x01]
+  @test binary_rows[3][4] isa UInt64
+  @test binary_csv[2] == "a,0.1234567890123,1,"
+  @test length(truncated_rows) == 3
+end
+
+# a buffered row keeps the value recorded, even if it later changes
+buffered_file = tempname()*".csv"
+buffered = Weber.RecordBuffer(Nullable(buffered_file))
+Weber.open_records!(buffered,[:code,:value])
+recorded_value = [1,2]
+buffered_row = Weber.next_row!(buffered,2)
+buffered_row[1],buffered_row[2] = :a,recorded_value
+Weber.freeze_row!(buffered_row)
+Weber.commit_record!(buffered,:a)
+recorded_value[1] = 5
+Weber.close_records!(buffered)
+
+@testset "Buffered Rows" begin
+  @test readlines(buffered_file) == ["code,value","a,$(string([1,2]))"]
+end
@@ -27,3 +27,78 @@ end
     @test comp_diff < moment_eps
   end
 end
+
+# many queues running at once are delivered in order of their deadlines
+conc_events,conc_times,_ = find_timing() do
+  addtrial((moment(0ms) >> moment((100 - 10i)*ms,() -> record(Symbol(:s,i)))
+            for i in 1:8)...)
+end
+
+@testset "Concurrent Compound Moments" begin
+  @test conc_events == [Symbol(:s,i) for i in 8:-1:1]
+  if check_timing
+    conc_diff = maximum(abs.(diff(conc_times) - 0.01))
+    @test conc_diff < moment_eps
+  end
+end
+
+@testset "Moment Queue Deadlines" begin
+  queues = Weber.MomentQueues(Weber.MomentQueue())
+  extra = [Weber.MomentQueue() for i in 1:6]
+  foreach(q -> push!(queues,q),extra)
+  deadlines = [0.5,0.1,0.3,0.1,Inf,0.2,0.4]
+  for (q,d) in zip(queues,deadlines)
+    Weber.update_deadline!(queues,q,d)
+  end
+  Weber.update_deadline!(queues,queues[7],0.05)
+
+  order = [Weber.pop_deadline!(queues) for i in 1:length(queues)]
+  @test map(q -> q.deadline,order) == [0.05,0.1,0.1,0.2,0.3,0.5,Inf]
+  @test order[2] === queues[2]
+  @test order[3] === queues[4]
+  @test all(q -> q.heap_index == 0,queues)
+end
+
+@testset "Moment Queue Reuse" begin
+  a,b,c = moment(() -> record(:a)),moment(() -> record(:b)),
+    moment(() -> record(:c))
+
+  q = Weber.MomentQueue(4)
+  Weber.enqueue!(q,c)
+  Weber.unshift_each!(q,[a,b])
+  @test collect(q) == [b,a,c]
+  @test length(q.data) == 4
+  Weber.unshift_each!(q,[a,b,c])
+  @test collect(q) == [c,b,a,b,a,c]
+  @test length(q.data) == 8
+
+  empty = Weber.MomentQueue(2)
+  Weber.unshift_each!(empty,[a,b,c])
+  @test collect(empty) == [c,b,a]
+
+  queues = Weber.MomentQueues(Weber.MomentQueue())
+  used = Weber.pooled_queue!(queues,[a,b],0.0)
+  @test collect(used) == [a,b]
+  Weber.dequeue!(used); Weber.dequeue!(used)
+  Weber.recycle!(queues,used)
+  reused = Weber.pooled_queue!(queues,[c,a,b],1.0)
+  @test reused === used
+  @test collect(reused) == [c,a,b]
+  @test reused.last == 1.0
+  @test Weber.very_first(reused)
+  @test isempty(queues.pool)
+end
+
+# the queues of finished compound moments are reused by later ones
+loop_events,_,_ = find_timing() do
+  @addtrials let n = 0
+    @addtrials while n < 5
+      addtrial(moment(() -> n += 1),
+               moment(1ms) >> moment(1ms,() -> record(:loop)))
+    end
+  end
+end
+
+@testset "Pooled Compound Moments" begin
+  @test loop_events == fill(:loop,5)
+end
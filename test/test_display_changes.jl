@@ -0,0 +1,34 @@
+using Weber
+using Base.Test
+
+struct TestVisual <: Weber.SDLTextured
+  rect::Weber.SDLRect
+end
+Weber.rect(x::TestVisual) = x.rect
+
+struct TestScreen
+  w::Cint
+  h::Cint
+end
+
+screen = TestScreen(100,100)
+a = TestVisual(Weber.SDLRect(0,0,10,10))
+b = TestVisual(Weber.SDLRect(50,50,20,10))
+background = Weber.SDLClear(colorant"gray",0.0,0)
+
+@testset "Display Changes" begin
+  @test isempty(Weber.damaged_rects(screen,[a,b],[a,b]))
+  @test Weber.damaged_rects(screen,[a],[a,b]) == [b.rect]
+  @test Weber.damaged_rects(screen,[a,b],[b]) == [a.rect]
+  @test Weber.damaged_rects(screen,[a,b],[b,a]) ==
+    [Weber.SDLRect(0,0,100,100)]
+  @test Weber.damaged_rects(screen,[a],[a,background]) ==
+    [Weber.SDLRect(0,0,100,100)]
+
+  many = [TestVisual(Weber.SDLRect(i,i,1,1)) for i in 1:10]
+  @test Weber.damaged_rects(screen,[a],[a,many...]) ==
+    [Weber.SDLRect(1,1,10,10)]
+
+  @test Weber.overlaps(a.rect,Weber.SDLRect(5,5,10,10))
+  @test !Weber.overlaps(a.rect,b.rect)
+end
@@ -0,0 +1,71 @@
+using Weber
+using Base.Test
+
+const event_bytes = zeros(UInt8,Weber.event_size)
+const event_ptr = Ptr{Void}(pointer(event_bytes))
+unsafe_store!(Ptr{UInt32}(event_ptr + Weber.timestamp_ptr),UInt32(1500))
+event_at_poll = Weber.event_time(event_ptr,10.0,UInt32(1500))
+event_before_poll = Weber.event_time(event_ptr,10.0,UInt32(1512))
+unsafe_store!(Ptr{UInt32}(event_ptr + Weber.timestamp_ptr),typemax(UInt32))
+event_wrapped = Weber.event_time(event_ptr,10.0,UInt32(4))
+unsafe_store!(Ptr{UInt32}(event_ptr + Weber.timestamp_ptr),UInt32(1502))
+event_after_poll = Weber.event_time(event_ptr,10.0,UInt32(1500))
+
+@testset "Event Times" begin
+  @test event_at_poll == 10.0
+  @test event_before_poll ≈ 9.988
+  @test event_wrapped ≈ 9.995
+  @test event_after_poll == 10.0
+end
+
+const decoded_keys = Ref(0)
+count_keys(exp,event::KeyDownEvent) = (decoded_keys[] += event.code; nothing)
+count_keys(exp,event) = nothing
+
+unsafe_store!(Ptr{UInt32}(event_ptr + Weber.type_ptr),Weber.SDL_KEYDOWN)
+unsafe_store!(Ptr{UInt32}(event_ptr + Weber.keysym_ptr + Weber.sym_ptr),
+              UInt32(97))
+function decode_events(n)
+  for i in 1:n
+    Weber.handle_sdl_event(count_keys,nothing,event_ptr,
+                           Weber.event_time(event_ptr,10.0,UInt32(4)))
+  end
+end
+decode_events(1)
+decode_allocated = @allocated decode_events(1000)
+
+@testset "Event Decoding Allocations" begin
+  @test decoded_keys[] == 97*1001
+  @test decode_allocated == 0
+end
+
+# events are timed by the poll that finds them, so the time between polls bounds
+# the error of event times
+include("find_timing.jl")
+struct PollTimes <: Weber.Extension
+  times::Vector{Float64}
+end
+function Weber.poll_events(callback,e::ExtendedExperiment{PollTimes},
+                           time::Float64)
+  push!(extension(e).times,time)
+  Weber.poll_events(callback,next(e),time)
+end
+
+const check_timing = get(ENV,"WEBER_TIMING_TESTS","Yes") != "No"
+spin_polls = Float64[]
+find_timing(extensions=[PollTimes(spin_polls)]) do
+  addtrial(moment(250ms,() -> record(:done)))
+end
+sleep_polls = Float64[]
+find_timing(extensions=[PollTimes(sleep_polls)],scheduler=:sleep) do
+  addtrial(moment(250ms,() -> record(:done)))
+end
+
+@testset "Event Polling" begin
+  @test length(spin_polls) > 100
+  @test length(sleep_polls) > 50
+  if check_timing
+    @test quantile(diff(spin_polls),0.9) < 0.002
+    @test quantile(diff(sleep_polls),0.9) < 0.004
+  end
+end
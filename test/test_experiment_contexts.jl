@@ -0,0 +1,28 @@
+using Weber
+using Base.Test
+
+function concurrent_session(code)
+  exp = Experiment(null_window=true,hide_output=true,data_dir=nothing)
+  rows = Weber.win(exp).records
+  setup(exp) do
+    addtrial(repeated(moment(20ms,() -> record(code)),10))
+  end
+  run(exp,await_input=false)
+  filter(r -> r[:code] ∈ [:a,:b],rows)
+end
+
+sessions = [@async(concurrent_session(:a)),@async(concurrent_session(:b))]
+rows_a,rows_b = map(wait,sessions)
+
+@testset "Experiment Contexts" begin
+  @test length(rows_a) == 10
+  @test length(rows_b) == 10
+  @test all(r -> r[:code] == :a,rows_a)
+  @test all(r -> r[:code] == :b,rows_b)
+  @test !Weber.in_experiment()
+
+  # each window keeps its own rows
+  a = Experiment(null_window=true,hide_output=true)
+  b = Experiment(null_window=true,hide_output=true)
+  @test Weber.win(a).records !== Weber.win(b).records
+end
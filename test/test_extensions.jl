@@ -56,7 +56,16 @@ _,_,extension_events2 = find_timing(extensions=[ExtensionC(),ExtensionB(),Extens
   addtrial(moment(1ms))
 end
 
+extended = Experiment(null_window=true,hide_output=true,
+                      extensions=[ExtensionA(),ExtensionB(),ExtensionC()])
+extension_chain(e) = next(next(next(top(e))))
+
 @testset "Extensions" begin
+  @test top(extended) isa ExtendedExperiment{ExtensionA}
+  @test @inferred(next(top(extended))) isa ExtendedExperiment{ExtensionB}
+  @test @inferred(extension_chain(extended)) isa Weber.BaseExtendedExperiment
+  @test @inferred(extension(next(next(top(extended))))) isa ExtensionC
+
   extension_event1 = filter(r -> r[:code] == :extension_c_polled,extension_events1)
   extension_event2 = filter(r -> r[:code] == :extension_c_polled,extension_events2)
   @test extension_event1[1][:extension_a] == :test
@@ -0,0 +1,48 @@
+using Weber
+using Base.Test
+include("find_timing.jl")
+
+gc_codes,_,gc_rows = find_timing(gc_report=true) do
+  addtrial(critical(moment(() -> record("in_critical",value=gc_enable(false)))),
+           moment(() -> record("after_critical",value=gc_enable(true))))
+  addtrial(moment(0.1s))
+end
+gc_values = Dict(r[:code] => r[:value] for r in gc_rows)
+
+boundary_codes,_,boundary_rows = find_timing(gc_report=true,
+                                             gc_policy=:boundaries) do
+  addtrial(moment(0.5s,() -> record("during_trial",value=gc_enable(false))))
+  addtrial(moment(0.5s))
+end
+
+@testset "GC Policy" begin
+  @test count(x -> x == "memory",gc_codes) == 2
+  @test all(r -> r[:alloc_bytes] isa Integer,
+            filter(r -> r[:code] == "memory",gc_rows))
+  @test gc_values["in_critical"] == false
+  @test gc_values["after_critical"] == true
+  @test "gc" ∈ boundary_codes
+  @test first(filter(r -> r[:code] == "during_trial",
+                     boundary_rows))[:value] == false
+  @test gc_enable(true)
+  @test_throws ErrorException Experiment(null_window=true,hide_output=true,
+                                         gc_policy=:never)
+end
+
+# collection stays disabled until every experiment that disabled it is done
+first_state = Weber.GCState(:boundaries,false)
+second_state = Weber.GCState(:boundaries,false)
+Weber.disable_gc!(first_state,true)
+Weber.disable_gc!(second_state,true)
+Weber.disable_gc!(first_state,false)
+Weber.disable_gc!(first_state,false)
+disabled_by_second = Weber.gc_disabling[]
+enabled_with_second = gc_enable(false)
+Weber.disable_gc!(second_state,false)
+
+@testset "Shared GC Disabling" begin
+  @test disabled_by_second == 1
+  @test enabled_with_second == false
+  @test Weber.gc_disabling[] == 0
+  @test gc_enable(true)
+end
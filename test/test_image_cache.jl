@@ -0,0 +1,32 @@
+using Weber
+using Base.Test
+
+struct TestImage <: Weber.SDLRendered
+  bytes::Int
+end
+Weber.cache_bytes(img::TestImage) = img.bytes
+
+cache = Weber.ImageCache(10)
+first_image = get!(() -> TestImage(4),cache,:a)
+get!(() -> TestImage(4),cache,:b)
+get!(() -> error("cache miss"),cache,:a)
+get!(() -> TestImage(4),cache,:c)
+
+img = rand(UInt8,4,4)
+img_key = Weber.image_key(img,())
+same_key = Weber.image_key(copy(img),())
+offset_key = Weber.image_key(img,[(:x,1)])
+img[1] += 0x01
+changed_key = Weber.image_key(img,())
+
+@testset "Image Cache" begin
+  @test first_image === TestImage(4)
+  @test collect(keys(cache.data)) == [:a,:c]
+  @test cache.bytes == 8
+  @test (cache.hits,cache.misses,cache.evictions) == (1,3,1)
+  @test img_key == same_key
+  @test img_key != offset_key
+  @test img_key != changed_key
+  resize!(cache,4)
+  @test collect(keys(cache.data)) == [:c]
+end
@@ -19,3 +19,20 @@ seq_trial_index = map(x -> x[:trial],rows)
   @test seq_trial_events == [:a,:b,:c,:a,:b,:c,:a,:b,:c]
   @test seq_trial_index == [1,1,1,2,2,2,3,3,3]
 end
+
+conditions_run = Ref(0)
+skip_trial_events,_,skip_rows = find_timing(skip=3) do
+  addtrial(moment(() -> record(:a)))
+  @addtrials if (conditions_run[] += 1) > 0
+    addtrial(moment(() -> record(:b)))
+  end
+  addpractice(moment(() -> record(:c)))
+  addtrial(moment(() -> record(:d)))
+end
+skip_trial_index = map(x -> x[:trial],skip_rows)
+
+@testset "Skipped Moment Indexing" begin
+  @test skip_trial_events == [:c,:d]
+  @test skip_trial_index == [1,2]
+  @test conditions_run[] == 0
+end
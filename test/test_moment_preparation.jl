@@ -61,3 +61,72 @@ end
   @test_throws TestPrepareException cause_prepare_error1()
   @test prepare_noerror == [:success]
 end
+
+deferred_steps = Float64[]
+find_timing() do
+  Weber.defer(() -> (push!(deferred_steps,Weber.tick()); length(deferred_steps) == 3))
+  addtrial(moment(0.25s,() -> record(:done)))
+end
+
+# jobs deferred during the setup of an experiment belong to that experiment
+unrun_job = Ref(false)
+unrun = Experiment(null_window=true,hide_output=true)
+setup(unrun) do
+  Weber.defer(() -> (unrun_job[] = true))
+end
+find_timing() do
+  addtrial(moment(0.1s,() -> record(:done)))
+end
+
+@testset "Deferred Jobs" begin
+  @test length(deferred_steps) == 3
+  @test all(t -> t < 0.25,deferred_steps)
+  @test !unrun_job[]
+  @test length(Weber.data(unrun).deferred) == 1
+end
+
+struct TestEarlyMoment <: Weber.AbstractTimedMoment
+  delta_t::Float64
+  event::Symbol
+end
+Weber.delta_t(m::TestEarlyMoment) = m.delta_t
+Weber.run(exp,q,m::TestEarlyMoment) = record(m.event)
+const early_times = Dict{Symbol,Float64}()
+Weber.prepare_early!(m::TestEarlyMoment) = get!(early_times,m.event,Weber.tick())
+
+function find_early_timing(horizon)
+  empty!(early_times)
+  ks,vs,_ = find_timing(prepare_horizon=horizon) do
+    addtrial(TestEarlyMoment(0.2,:a),TestEarlyMoment(0.2,:b),
+             TestEarlyMoment(0.2,:c),TestEarlyMoment(0.2,:d))
+  end
+  Dict(k => v for (k,v) in zip(ks,vs)),copy(early_times)
+end
+
+early_onsets,early_prepared = find_early_timing(500ms)
+_,unprepared = find_early_timing(0s)
+
+@testset "Prepare Horizon" begin
+  @test isempty(unprepared)
+  for (event,other) in [(:c,:a),(:d,:b)]
+    @test haskey(early_prepared,event)
+    @test early_prepared[event] < early_onsets[other] + 0.1
+    @test early_onsets[event] - early_prepared[event] <= 0.5 + 0.05
+  end
+end
+
+# a sound generated early is used by `prepare!`, and isn't generated again while
+# its moment waits for its onset
+sound_calls = Ref(0)
+early_sound = Weber.PlayFunctionMoment(0.2,() -> (sound_calls[] += 1;
+                                                  silence(10ms)),
+                                       1,Weber.no_trace)
+Weber.prepare_early!(early_sound)
+Weber.prepare!(early_sound,Inf)
+Weber.prepare_early!(early_sound)
+
+@testset "Early Sound Preparation" begin
+  @test sound_calls[] == 1
+  @test isnull(early_sound.sound)
+  @test !isnull(early_sound.prepared)
+end
@@ -16,3 +16,21 @@ if check_timing
     @test mean(middle99) < moment_eps
   end
 end
+
+@testset "Moment Precompilation" begin
+  types = Set{DataType}()
+  closures = Dict{DataType,Function}()
+  a = () -> record(:a)
+  Weber.collect_moment_types!(types,closures,
+    moment(moment(1ms,a) >> moment(1ms,() -> record(:b))))
+  @test Weber.CompoundMoment ∈ types
+  @test Weber.TimedMoment ∈ types
+  @test length(closures) == 2
+
+  exp = Experiment(null_window=true,hide_output=true)
+  setup(exp,precompile_moments=false) do
+    addtrial(moment(1ms,a))
+  end
+  run(exp,await_input=false)
+  @test any(x -> x[:code] == :a,Weber.win(exp).records)
+end
@@ -0,0 +1,25 @@
+using Weber
+using Base.Test
+
+traced_moments = [moment(() -> nothing) for i in 1:3]
+traces = map(Weber.moment_trace,traced_moments)
+frames = Weber.stack_trace(traces[1])
+
+# the mode belongs to the experiment the moments are created for, and isn't
+# changed by creating another experiment
+untraced_exp = Experiment(null_window=true,hide_output=true,moment_traces=:none)
+Experiment(null_window=true,hide_output=true)
+untraced = Ref(Weber.MomentTrace(1))
+setup(untraced_exp) do
+  untraced[] = Weber.moment_trace(moment(() -> nothing))
+end
+
+@testset "Moment Traces" begin
+  @test traces[1] isa Weber.MomentTrace
+  @test traces[1] == traces[2] == traces[3]
+  @test !isempty(frames)
+  @test all(f -> f.func != :capture_trace,frames)
+  @test any(f -> contains(string(f.file),"test_moment_traces.jl"),frames)
+  @test isempty(untraced[])
+  @test isempty(Weber.stack_trace(untraced[]))
+end
@@ -18,7 +18,17 @@ function cause_reserved_error(decl,use=decl)
   nothing
 end
 
+_,_,column_rows = find_timing(columns=[:sid => "test_sid",:value2]) do
+  addtrial(moment(record,"a",value2=1),
+           moment(record,"b",value=:x,value2=2),
+           moment(record,"c"))
+end
+
 @testset "Record Columns" begin
+  @test map(r -> r[:sid],column_rows) == ["test_sid","test_sid","test_sid"]
+  @test map(r -> r[:value2],column_rows) == [1,2,""]
+  @test map(r -> r[:value],column_rows) == ["",:x,""]
+  @test all(r -> r[:trial] == 1,column_rows)
   @test_throws ErrorException cause_column_error()
   @test_throws ErrorException cause_reserved_error(:weber_version)
   @test_throws ErrorException cause_reserved_error(:start_date)
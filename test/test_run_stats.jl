@@ -0,0 +1,28 @@
+using Weber
+using Base.Test
+
+histogram = Weber.LatencyHistogram()
+for us in 1:10000
+  Weber.observe!(histogram,us*1e-6)
+end
+indices = map(us -> Weber.bucket_index(UInt64(us)),[0,63,64,2^32-1])
+
+stats_exp = Experiment(null_window=true,hide_output=true)
+setup(stats_exp) do
+  addtrial(moment(0.1s),moment(0.1s))
+end
+run(stats_exp,await_input=false)
+stats = Weber.run_stats(stats_exp)
+
+@testset "Run Statistics" begin
+  @test indices == [1,64,65,length(histogram.counts)]
+  @test all(Weber.bucket_value(Weber.bucket_index(UInt64(us))) == us
+            for us in 0:63)
+  @test histogram.n == 10000
+  @test abs(quantile(histogram,0.5) - 0.005) < 0.005*0.04
+  @test abs(quantile(histogram,0.99) - 0.0099) < 0.0099*0.04
+  @test quantile(histogram,1.0) <= histogram.max
+  @test stats.loop.n > 0
+  @test !isempty(stats.moments)
+  @test all(h -> h.n > 0,values(stats.moments))
+end
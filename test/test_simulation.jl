@@ -0,0 +1,43 @@
+using Weber
+using Base.Test
+include("find_timing.jl")
+
+clock_started = Weber.precise_time()
+virtual_codes,virtual_times,_ = find_timing(scheduler=:virtual) do
+  addtrial(moment(10s,record,:a),moment(20s,record,:b))
+end
+virtual_elapsed = Weber.precise_time() - clock_started
+
+pressed = Ref(false)
+function press_p(exp,time)
+  if time >= 1.0 && !pressed[]
+    pressed[] = true
+    Weber.KeyDownEvent(key"p",time + 0.25)
+  end
+end
+
+observed = simulate(observer=press_p) do
+  addtrial(moment(1s),response(key"p" => "pressed"),
+           await_response(iskeydown(key"p")),moment(record,:after))
+end
+observed_times = Dict(r[:code] => r[:time] for r in observed)
+
+sessions = simulate_sessions(3,parallel=false) do i
+  addtrial(moment(i*1s,record,:done,value=rand()))
+end
+done_rows = [filter(r -> r[:code] == :done,rows)[1] for rows in sessions]
+repeated = simulate(seed=2) do
+  addtrial(moment(2s,record,:done,value=rand()))
+end
+
+@testset "Simulated Experiments" begin
+  @test virtual_codes == [:a,:b]
+  @test virtual_times ≈ [10.0,30.0]
+  @test virtual_elapsed < 5.0
+
+  @test observed_times["pressed"] ≈ 1.25
+  @test observed_times[:after] ≈ 1.25
+
+  @test [r[:time] for r in done_rows] ≈ [1.0,2.0,3.0]
+  @test filter(r -> r[:code] == :done,repeated)[1][:value] == done_rows[2][:value]
+end
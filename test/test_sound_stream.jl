@@ -0,0 +1,23 @@
+using Weber
+using Base.Test
+
+chunks = (silence(10ms) for i in 1:6)
+s = Weber.fill_stream!(Weber.SoundStream(chunks,0.5,4))
+full_count = s.count
+first_chunk = Weber.shift_chunk!(s)
+Weber.shift_chunk!(s)
+Weber.fill_stream!(s)
+refill_count = s.count
+foreach(i -> Weber.shift_chunk!(s),1:4)
+Weber.fill_stream!(s)
+
+@testset "Sound Streams" begin
+  @test full_count == 4
+  @test duration(first_chunk) ≈ 10ms
+  @test refill_count == 4
+  @test s.finished
+  @test s.count == 0
+  @test !Weber.fill_chunk!(s)
+  @test Weber.finished(s)
+  @test_throws ErrorException stream(chunks)
+end
@@ -0,0 +1,14 @@
+using Weber
+using Base.Test
+
+# every character is 10 pixels wide
+width(str) = 10length(str)
+
+@testset "Text Layout" begin
+  @test Weber.wrap_lines(width,"one two three",0) == ["one two three"]
+  @test Weber.wrap_lines(width,"one two three",70) == ["one two","three"]
+  @test Weber.wrap_lines(width,"one two three",30) == ["one","two","three"]
+  @test Weber.wrap_lines(width,"one\ntwo three",100) == ["one","two three"]
+  @test Weber.wrap_lines(width,"overlong word",30) == ["overlong","word"]
+  @test Weber.wrap_lines(width,"",30) == [""]
+end
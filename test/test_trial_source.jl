@@ -0,0 +1,45 @@
+using Weber
+using Base.Test
+include("find_timing.jl")
+
+created = Int[]
+function source_trial(i)
+  push!(created,i)
+  moment(() -> record(:a,value=i)),moment(() -> record(:b,value=i))
+end
+
+source_events,_,source_rows = find_timing() do
+  addtrial(moment(() -> record(:start)))
+  addtrials(source_trial,1:5,lookahead=2)
+  addtrial(moment(() -> record(:end)))
+end
+
+empty!(created)
+_,_,skip_rows = find_timing(skip=4) do
+  addtrial(moment(() -> record(:start)))
+  addtrials(source_trial,1:5,lookahead=2)
+  addtrial(moment(() -> record(:end)))
+end
+
+loop_events,_,_ = find_timing() do
+  @addtrials let i = 0
+    @addtrials while i < 2
+      addtrial(moment(() -> i+=1))
+      addtrials(j -> moment(() -> record(:a,value=j)),1:3,lookahead=2)
+    end
+  end
+end
+
+@testset "Trial Sources" begin
+  @test source_events == [:start,repeat([:a,:b],outer=5)...,:end]
+  @test map(x -> x[:trial],source_rows) == [1,repeat(2:6,inner=2)...,7]
+  @test map(x -> x[:value],source_rows[2:end-1]) == repeat(1:5,inner=2)
+
+  # offsets 1-3 are skipped, the source starts at its third trial
+  @test created == [3,4,5]
+  @test map(x -> x[:value],skip_rows[1:end-1]) == repeat(3:5,inner=2)
+  @test map(x -> x[:trial],skip_rows) == [repeat(4:6,inner=2)...,7]
+
+  # a source within a loop creates all of its trials on each iteration
+  @test loop_events == repeat([:a],outer=6)
+end
@@ -1,15 +1,17 @@
 using Weber
-using DataFrames: writetable, DataFrame
+using DataFrames: readtable, writetable, DataFrame
 
 # HOW TO USE: Setup a video camera in front of your computer monitor and then
 # run this script. Try as best you can to center the the monitor in the camera's
 # view. Press record on the camera and then hit spacebar to start the
 # test. Ideally you should increase the frame rate of your camera to at least 60
 # fps. You can then use analyze_videotiming.jl to the extract onsets from the
-# recorded image, and determine the timing accuracy of video playback.
+# recorded image, and determine the timing accuracy of video playback. The
+# squares are aligned to the nearest screen refresh, and video_timing.csv
+# lists both the intended onsets and the time of each refresh (flip) reported
+# by the experiment, relative to the start of the trial.
 
 timing = 0.5abs.(randn(Float64,100)) + 0.3
-writetable("video_timing.csv",DataFrame(times = cumsum(timing),lengths = timing/2))
 
 exp = Experiment()
 setup(exp) do
@@ -19,9 +21,20 @@ setup(exp) do
 
   black = moment(t -> display(blackness))
   moments = map(timing) do delta
-    moment(delta,t -> display(square))
+    moment(delta,display,square,flip=true)
   end
   addtrial(black,moments)
 end
 
 run(exp)
+
+recorded = readtable(get(Weber.info(exp).file))
+trial_start = recorded[recorded[:code] .== "trial_start",:time][end]
+flips = recorded[recorded[:code] .== "flip",:]
+missed = recorded[recorded[:code] .== "missed_frames",:value]
+println("Missed $(sum(missed)) frames.")
+
+writetable("video_timing.csv",DataFrame(times = cumsum(timing),
+                                        lengths = timing/2,
+                                        flips = flips[:time] - trial_start,
+                                        flip_error = flips[:value]))